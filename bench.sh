@@ -0,0 +1,41 @@
+#!/bin/sh
+# Replay throughput of every vmsim code path over generated traces:
+# accesses per second and ns per access, the best of BENCH_RUNS runs.
+# BENCH_RECORDS, BENCH_RUNS and BENCH_DIR override the defaults.
+DIR=${BENCH_DIR:-bench}
+RECORDS=${BENCH_RECORDS:-1000000}
+RUNS=${BENCH_RUNS:-3}
+PATTERNS="seq stride uniform zipf phase"
+
+# path name and vmsim options, the trace kind last
+PATHS="text::trace
+pipelined:-p:trace
+batch::bin
+batch_pte4:-m 256M:bin
+batch_generic:-g 8K:bin
+batch_radix:-L 2:bin"
+
+mkdir -p $DIR || exit 1
+for p in $PATTERNS; do
+  if [ ! -f $DIR/$p-$RECORDS.bin ]; then
+    ./tracegen -p $p -n $RECORDS $DIR/$p-$RECORDS || exit 1
+  fi
+done
+
+echo "pattern, path, accesses, seconds, accesses_per_s, ns_per_access"
+for p in $PATTERNS; do
+  echo "$PATHS" | while IFS=: read name opts kind; do
+    best=""
+    i=0
+    while [ $i -lt $RUNS ]; do
+      line=`./vmsim -B $opts $DIR/$p-$RECORDS.$kind 2>&1 >/dev/null | grep '^throughput'`
+      if [ -z "$line" ]; then
+        echo "$p, $name, failed"
+        break
+      fi
+      best=`printf '%s\n%s\n' "$best" "$line" | awk -F', ' 'NF == 5 && (!s || $3 < s) { s = $3; l = $0 } END { print l }'`
+      i=$((i + 1))
+    done
+    [ -n "$best" ] && echo "$best" | sed "s/^throughput/$p, $name/"
+  done
+done
@@ -0,0 +1,65 @@
+#include <string.h>
+#include <sys/types.h>
+
+#include "checkpoint.h"
+
+/*
+* Save the n bytes at p, or restore them from the checkpoint
+* Errors stick in c->error and turn later calls into no-ops.
+*/
+void ckpt_bytes(ckpt_t* c, void* p, size_t n)
+{
+    if (c->error || !n) {
+        return;
+    }
+    if (c->out) {
+        if (fwrite(p, 1, n, c->out) != n) {
+            c->error = 1;
+            return;
+        }
+    } else {
+        if (c->pos + n > c->length) {
+            c->error = 1;
+            return;
+        }
+        memcpy(p, c->in + c->pos, n);
+    }
+    c->pos += n;
+}
+
+// n bytes at p, all zero?
+static int all_zero(const byte_t* p, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (p[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+* Save the n bytes at p like ckpt_bytes(), leaving a hole in the file
+* for each all zero block of block bytes (it reads back as zeros)
+* Only for saving: restores map the file.
+*/
+void ckpt_sparse(ckpt_t* c, const void* p, size_t n, size_t block)
+{
+    const byte_t* b = p;
+    int hole = 0;
+    for (size_t i = 0; i < n && !c->error; i += block) {
+        size_t len = n - i < block ? n - i : block;
+        if (all_zero(b + i, len)) {
+            hole = fseeko(c->out, (off_t)len, SEEK_CUR) == 0;
+            c->error = !hole;
+            c->pos += len;
+        } else {
+            hole = 0;
+            ckpt_bytes(c, (void*)(b + i), len);
+        }
+    }
+    // a hole at the end doesn't make the file any longer
+    if (hole && (fseeko(c->out, -1, SEEK_CUR) != 0 || fputc(0, c->out) == EOF)) {
+        c->error = 1;
+    }
+}
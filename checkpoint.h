@@ -0,0 +1,29 @@
+#ifndef __CHECKPOINT_H
+#define __CHECKPOINT_H
+
+#include <stdio.h>
+
+#include "vmsim.h"
+
+// ---------------------------------------------------------
+// Checkpoint streams: one walk over the simulator state both saves
+// it (out set) and restores it (in set, a mapped checkpoint file),
+// so the two can't disagree on the layout. Each module walks its own
+// state in a <module>_checkpoint(ckpt_t*) function, see
+// vm_checkpoint() for the file.
+// ---------------------------------------------------------
+typedef struct ckpt_t {
+    FILE* out;          // saving
+    const byte_t* in;   // restoring
+    size_t pos;         // bytes saved or restored so far
+    size_t length;      // restoring: bytes that may be read
+    int error;
+} ckpt_t;
+
+void ckpt_bytes(ckpt_t* c, void* p, size_t n);
+void ckpt_sparse(ckpt_t* c, const void* p, size_t n, size_t block);
+
+// a variable's bytes
+#define CKPT(c, var) ckpt_bytes((c), &(var), sizeof(var))
+
+#endif
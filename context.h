@@ -0,0 +1,137 @@
+#ifndef __CONTEXT_H
+#define __CONTEXT_H
+
+#include <stdlib.h>
+
+#include "vmsim.h"
+#include "tlb.h"
+#include "huge.h"
+#include "replace.h"
+#include "prefetch.h"
+#include "stats.h"
+#include "sample.h"
+
+// ---------------------------------------------------------
+// One core: its TLBs and prefetcher, and the process it runs. The
+// running core's TLBs are copied into the context (tlb_t only points
+// at the entries, so both copies see the same ones).
+// ---------------------------------------------------------
+typedef struct core_t {
+    tlb_t TLB, STLB, PWC, PB;
+    prefetch_state_t pf;
+    uint pid;
+    uint32_t asid;
+    core_stats_t stats;
+} core_t;
+
+// ---------------------------------------------------------
+// A simulation's state, for the modules of the simulator only
+// (vmsim.h has the API). Everything a simulation changes is here,
+// nothing is global.
+// ---------------------------------------------------------
+struct vmsim_ctx {
+    vm_config_t config;     // huge_ranges -> ranges or the checkpoint mapping
+    vm_geometry_t geo;
+    vm_counters_t count;
+    vm_range_t* ranges;     // copy of the caller's huge_ranges
+    byte_t* mem;            // config.mem_size bytes, an anonymous mapping made by
+                            // system_init() or inside a restored checkpoint's
+    byte_t* mem_map;        // (the whole mapping)
+    size_t mem_map_length;
+    // rand() of the simulation, same sequence as srand(config.seed)
+    struct random_data rng;
+    int32_t rng_state[32];
+    // ---------------------------------------------------------
+    // the running core's TLBs
+    tlb_t TLB;
+    tlb_t STLB;             // second level, STLB.sets == 0 if there is none
+    tlb_t PWC;              // page walk cache: (ASID, VPN prefix, level) -> table frame
+    tlb_t PB;               // TLB prefetch buffer, PB.sets == 0 if there is no prefetcher
+    // ---------------------------------------------------------
+    // Cores: config.cores of them, the running one and per ASID the
+    // cores that ran it since their last flush (the shootdown targets)
+    // and all that ever ran it
+    // ---------------------------------------------------------
+    core_t* cores;
+    uint cur_core;
+    uint64_t* asid_cores;
+    uint64_t* asid_ran;
+    FT_entry* frametable;
+    byte_t* pagetable;      // geo.num_pages PTEs of geo.pte_bytes each, or
+                            // the inverted page table
+    uint32_t pt_asid;       // the process whose table pagetable is
+    // ---------------------------------------------------------
+    // Frame indexes for page_fault(), kept next to the frame table
+    // free_frames: bit f set -> frame f is unmapped and unprotected
+    // evictable:   dense list of the unprotected frames, so a random
+    //              victim is one rand() draw
+    // Frames from frame_hwm on were never handed out: they are free
+    // but in neither index, so the indexes grow with the frames used.
+    // ---------------------------------------------------------
+    uint64_t* free_frames;
+    uint32_t frame_words;
+    uint32_t free_hint;     // no free frames in words below this
+    ppn_t* evictable;
+    uint32_t* evictable_pos;    // per frame: index in evictable
+    uint32_t num_evictable;
+    ppn_t frame_hwm;
+    // page replacement policy, from config.policy
+    const policy_t* policy;
+    policy_state_t pol;
+    // ---------------------------------------------------------
+    // Processes: pid -> ASID + 1 (0 -> not seen yet). The running
+    // process's page table is pagetable, its ASID is also kept
+    // shifted into place for TLB keys.
+    // ---------------------------------------------------------
+    uint16_t asid_of_pid[1 << 16];
+    proc_stats_t* proc_stats;   // by ASID
+    uint32_t num_procs;
+    uint cur_pid;
+    uint32_t cur_asid;
+    vpn_t asid_key;             // cur_asid << VPN_BITS
+    proc_stats_t slice_start;   // counters when cur_pid got its core
+    TLB_entry* flushed;         // tlb_flush() buffer
+    // writeback queue: completion cycles of the writebacks in flight, a
+    // ring of config.latency.queue, and when the disk is free again
+    counter_t* wb_done;
+    uint32_t wb_head, wb_count;
+    counter_t wb_free;
+    // ---------------------------------------------------------
+    // Huge pages, if geo.huge_order: the regions of every process, the
+    // next block a promotion may take over and room to move a region
+    // ---------------------------------------------------------
+    huge_table_t huge_regions;
+    uint64_t huge_hand;
+    byte_t* huge_buffer;        // config.huge_size bytes
+    uint8_t* huge_moved;        // per base page of the region: resident,
+                                // | 2 if it's an unused fault prefetch,
+                                // | 4 if it's dirty
+    // prefetching: the TLB prefetcher, and per frame whether a page fault
+    // cluster brought its page in and it hasn't been accessed yet
+    const prefetcher_t* prefetcher;
+    prefetch_state_t* pf;       // the running core's
+    uint8_t* prefetched;        // NULL if config.fault_cluster < 2
+    // memory_access_batch() for the current geometry, fast -> fast-forwarded
+    size_t (*batch_fn)(vmsim_ctx* vm, const record_t* recs, size_t n, byte_t* out, int fast);
+    stats_state_t stats;
+    sample_state_t sample;
+    int fast_forwarding;        // inside a run of fast-forwarded accesses
+    // the error that stopped the simulation, NULL while there is none
+    // (vmsim_error()), and the record it stopped at
+    const char* error;
+    char error_msg[128];
+    uint64_t error_record;
+};
+
+void vm_fail(vmsim_ctx* vm, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+// the simulation's next rand()
+static inline uint32_t vm_rand(vmsim_ctx* vm)
+{
+    int32_t r;
+    random_r(&vm->rng, &r);
+    return r;
+}
+
+#endif
@@ -0,0 +1,95 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "huge.h"
+
+#define HUGE_TABLE_MIN 1024
+
+static size_t slot_of(const huge_table_t* t, vpn_t key)
+{
+    size_t h = (key * 0x9E3779B97F4A7C15ULL) >> 20 & (t->size - 1);
+    while (t->slot[h].key && t->slot[h].key != key) {
+        h = (h + 1) & (t->size - 1);
+    }
+    return h;
+}
+
+/*
+* Allocate an empty region table
+* returns 0 on success, -1 out of memory
+*/
+int huge_table_init(huge_table_t* t)
+{
+    t->size = HUGE_TABLE_MIN;
+    t->count = 0;
+    t->slot = calloc(t->size, sizeof(huge_region_t));
+    return t->slot ? 0 : -1;
+}
+
+void huge_table_free(huge_table_t* t)
+{
+    free(t->slot);
+    memset(t, 0, sizeof(*t));
+}
+
+/*
+* Save or restore a table, restoring one that had grown reallocates
+* the slots
+*/
+void huge_table_checkpoint(ckpt_t* c, huge_table_t* t)
+{
+    size_t size = t->size;
+    CKPT(c, size);
+    if (!c->error && size != t->size) {
+        huge_region_t* slot = calloc(size, sizeof(huge_region_t));
+        if (!slot) {
+            c->error = 1;
+            return;
+        }
+        free(t->slot);
+        t->slot = slot;
+        t->size = size;
+    }
+    CKPT(c, t->count);
+    ckpt_bytes(c, t->slot, t->size * sizeof(huge_region_t));
+}
+
+// twice the slots, every region rehashed
+static int grow(huge_table_t* t)
+{
+    huge_table_t bigger = { calloc(t->size * 2, sizeof(huge_region_t)), t->size * 2, t->count };
+    if (!bigger.slot) {
+        return -1;
+    }
+    for (size_t i = 0; i < t->size; i++) {
+        if (t->slot[i].key) {
+            bigger.slot[slot_of(&bigger, t->slot[i].key)] = t->slot[i];
+        }
+    }
+    free(t->slot);
+    *t = bigger;
+    return 0;
+}
+
+/*
+* Find the region with this key, adding it (not resident, not huge)
+* if create is set
+* returns the region, NULL if it isn't there or out of memory
+*/
+huge_region_t* huge_region(huge_table_t* t, vpn_t key, int create)
+{
+    key++;
+    size_t h = slot_of(t, key);
+    if (t->slot[h].key || !create) {
+        return t->slot[h].key ? &t->slot[h] : NULL;
+    }
+    if (2 * (t->count + 1) > t->size) {
+        if (grow(t) != 0) {
+            return NULL;
+        }
+        h = slot_of(t, key);
+    }
+    t->count++;
+    t->slot[h].key = key;
+    return &t->slot[h];
+}
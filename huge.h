@@ -0,0 +1,30 @@
+#ifndef __HUGE_H
+#define __HUGE_H
+
+#include "vmsim.h"
+#include "checkpoint.h"
+
+// ---------------------------------------------------------
+// Huge page regions: an aligned run of 1 << geo.huge_order base
+// pages of one process, keyed by ASID << VPN_BITS | VPN >> huge_order.
+// Regions are added on their first page fault and never removed.
+// ---------------------------------------------------------
+typedef struct huge_region_t {
+    vpn_t key;          // region key + 1, 0 -> empty slot
+    uint32_t resident;  // base pages mapped to a frame
+    uint32_t huge;      // 1 -> mapped as one huge page
+} huge_region_t;
+
+// open addressing hash table, at most half full
+typedef struct huge_table_t {
+    huge_region_t* slot;
+    size_t size;        // power of two
+    size_t count;
+} huge_table_t;
+
+int huge_table_init(huge_table_t* t);
+void huge_table_free(huge_table_t* t);
+huge_region_t* huge_region(huge_table_t* t, vpn_t key, int create);
+void huge_table_checkpoint(ckpt_t* c, huge_table_t* t);
+
+#endif
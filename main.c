@@ -1,47 +1,534 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "vmsim.h"
+#include "trace.h"
+#include "replace.h"
+#include "stackdist.h"
+#include "sweep.h"
+#include "prefetch.h"
+#include "stats.h"
+
+// the command line's config, its geometry and the simulation of it
+vm_config_t vm_config = VM_CONFIG_DEFAULT;
+vm_geometry_t geo;
+vmsim_ctx *vm = NULL;
 
 FILE *open_trace(const char *filename) {
   return fopen(filename, "r");
 }
 
+// -K/-n/-r: records are counted from the start of the trace, the
+// first skip_records of them were simulated before the restore
+const char *checkpoint_file = NULL;
+size_t checkpoint_at = 0;
+size_t skip_records = 0, records_done = 0;
+
+// a new simulation of vm_config (its geometry was checked already)
+void start_simulation() {
+  vmsim_destroy(vm);
+  vm = vmsim_create(&vm_config);
+  if (!vm) {
+    fprintf(stderr, "Out of memory for the simulation!\n");
+    exit(1);
+  }
+}
+
+// the simulation stopped with an error
+void stop_simulation() {
+  uint64_t record = 0;
+  const char *error = vmsim_error(vm, &record);
+  fprintf(stderr, "%s after %llu records!\n", error, (counter_t)record);
+  exit(1);
+}
+
+// sampled, but every access was fast-forwarded: nothing to estimate from
+void check_estimates() {
+  const vm_counters_t *k = vmsim_counters(vm);
+  if (k->ff_accesses && !k->accesses) {
+    fprintf(stderr, "No access was simulated in detail, the trace is shorter than a sampling period!\n");
+    exit(1);
+  }
+}
+
+void take_checkpoint() {
+  if (vm_checkpoint(vm, checkpoint_file, records_done) != 0) {
+    fprintf(stderr, "Can't write checkpoint %s!\n", checkpoint_file);
+    exit(1);
+  }
+}
+
 addr_t prev_addr;
+char *line;
+size_t line_cap;
 int next_line(FILE* trace) {
-  if (feof(trace) || ferror(trace)) return 0;
+  ssize_t len = getline(&line, &line_cap, trace);
+  if (len < 0) return 0;
   else {
-    char t;
-    unsigned long long va, pa;
-    unsigned sz;
-    fscanf(trace, "%c %llx %llx %u\n", &t, &va, &pa, &sz);
-    prev_addr = pa & (0x00FFFFFF); //force addresses to 24 bits
-    byte_t val = memory_access(prev_addr, (t == 'w'), (byte_t)(sz));
+    record_t rec;
+    if (len && line[len - 1] == '\n') len--;
+    if (!trace_parse_line(line, line + len, &rec)) return 1;
+    if (records_done++ < skip_records) return 1;
+    // "op va pa size [pid [cpu]]"
+    if (vm_core(vm, rec.cpu) != 0 || vm_switch(vm, rec.pid) != 0) stop_simulation();
+    prev_addr = rec.pa & geo.va_mask; //force addresses to va_bits (24 by default)
+    byte_t val = memory_access(vm, prev_addr, (rec.op == 'w'), (byte_t)(rec.size));
+    if (vmsim_error(vm, NULL)) stop_simulation();
+    if (checkpoint_file && records_done == checkpoint_at) take_checkpoint();
 
     //printf("%u\n",val);
   }
   return 1;
 }
 
+// binary traces and streamed batches: whole arrays of records at once
+void replay_records(const record_t *rec, size_t n) {
+  if (records_done < skip_records) {
+    size_t skip = skip_records - records_done < n ? skip_records - records_done : n;
+    records_done += skip;
+    rec += skip;
+    n -= skip;
+  }
+  if (checkpoint_file && records_done < checkpoint_at && checkpoint_at <= records_done + n) {
+    size_t first = checkpoint_at - records_done;
+    if (memory_access_batch(vm, rec, first, NULL) != 0) stop_simulation();
+    records_done += first;
+    take_checkpoint();
+    rec += first;
+    n -= first;
+  }
+  if (memory_access_batch(vm, rec, n, NULL) != 0) stop_simulation();
+  records_done += n;
+}
+
+// text traces parsed by a reader thread while we simulate
+int replay_stream(FILE *input) {
+  trace_stream_t *stream = trace_stream_open(input);
+  if (!stream) return 0;
+  const trace_batch_t *batch;
+  while ((batch = trace_stream_next(stream))) {
+    replay_records(batch->records, batch->count);
+    trace_stream_release(stream);
+  }
+  return !trace_stream_close(stream);
+}
+
+// wall clock seconds, for -B
+double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// -K past the end of the trace
+int checkpoint_missed(const char *trace) {
+  if (!checkpoint_file || records_done >= checkpoint_at) return 0;
+  fprintf(stderr, "Trace %s ends before record %zu, no checkpoint!\n", trace, checkpoint_at);
+  return 1;
+}
+
+// -B: replay throughput on stderr, the stats stay alone on stdout
+void print_throughput(double seconds) {
+  counter_t accesses = vmsim_counters(vm)->accesses + vmsim_counters(vm)->ff_accesses;
+  fprintf(stderr, "throughput, %llu, %.6f, %.0f, %.2f\n", accesses, seconds,
+          seconds > 0 ? accesses / seconds : 0.0, accesses ? seconds * 1e9 / accesses : 0.0);
+}
+
+// -P list -> policy ids, returns how many, 0 on a bad name
+int parse_policies(char *list, int *ids, int max) {
+  int n = 0;
+  for (char *name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+    if (n == max || (ids[n] = policy_find(name)) < 0) return 0;
+    n++;
+  }
+  return n;
+}
+
+// the whole trace in memory, for runs that replay it more than once
+const record_t *load_records(FILE *input, int binary, trace_map_t *map,
+                             size_t *n) {
+  if (binary) {
+    *n = map->count;
+    return map->records;
+  }
+  return trace_load(input, n);
+}
+
+void usage(const char *prog) {
+  fprintf(stderr, "Usage:\n  %s [-psCAxB] [-t entries] [-a ways] [-T entries] [-w ways]\n"
+          "         [-c entries] [-m mem] [-g page] [-v bits] [-L levels] [-F fanout] [-I] [-N procs] [-M cores] [-f]\n"
+          "         [-H size] [-u pages] [-R ranges] [-q prefetcher] [-b entries] [-k pages]\n"
+          "         [-l latencies] [-S period,window[,warmup]] [-i accesses] [-o file]\n"
+          "         [-K file] [-n records] [-r file]\n"
+          "         [-P policies] [-W configs] [-j jobs] <trace>\n", prog);
+  fprintf(stderr, "  -p       parse text traces on a reader thread\n");
+  fprintf(stderr, "  -t N     TLB entries (default %d)\n", TLB_SIZE);
+  fprintf(stderr, "  -a N     TLB ways, entries / ways must be a power of two\n");
+  fprintf(stderr, "           (default fully associative)\n");
+  fprintf(stderr, "  -m N     physical memory bytes, K/M/G suffixes (default 2M)\n");
+  fprintf(stderr, "  -g N     page size bytes, a power of two (default 4K)\n");
+  fprintf(stderr, "  -v N     virtual address bits (default %d)\n", VA_BITS);
+  fprintf(stderr, "  -L N     page table levels, 1 flat (default) to %d, tables\n", PT_MAX_LEVELS);
+  fprintf(stderr, "           below the root are allocated as pages are touched\n");
+  fprintf(stderr, "  -F N     entries per table below the root (default a page full)\n");
+  fprintf(stderr, "  -I       one hashed inverted page table for all processes, an\n");
+  fprintf(stderr, "           entry per frame (flat only), prints walk references,\n");
+  fprintf(stderr, "           chain probes, probes per walk, its frames and those of\n");
+  fprintf(stderr, "           flat tables on an \"inverted page table\" line\n");
+  fprintf(stderr, "  -N N     processes (trace pids) with a page table (default 1)\n");
+  fprintf(stderr, "  -M N     cores with their own TLBs, picked by the trace's cpu\n");
+  fprintf(stderr, "           column (default 1), evictions shoot down the mapping on\n");
+  fprintf(stderr, "           the other cores that ran its process, several cores\n");
+  fprintf(stderr, "           print a \"core\" line each and a \"shootdowns\" line\n");
+  fprintf(stderr, "  -f       flush the TLB on context switches instead of\n");
+  fprintf(stderr, "           keeping entries tagged with their ASID\n");
+  fprintf(stderr, "  -T N     L2 TLB entries (default none)\n");
+  fprintf(stderr, "  -w N     L2 TLB ways (default fully associative)\n");
+  fprintf(stderr, "  -x       exclusive L2 TLB (holds L1 victims), default inclusive\n");
+  fprintf(stderr, "  -c N     page walk cache entries for radix page tables\n");
+  fprintf(stderr, "  -H N     huge page bytes, K/M/G suffixes (default none), a\n");
+  fprintf(stderr, "           region is promoted once all its base pages are resident\n");
+  fprintf(stderr, "  -u N     promote a region once N of its base pages are resident\n");
+  fprintf(stderr, "  -R list  huge pages from the first touch in these start-end\n");
+  fprintf(stderr, "           ranges, comma separated (others only with -u)\n");
+  fprintf(stderr, "           huge page runs print base page and huge page TLB hits,\n");
+  fprintf(stderr, "           promotions and splits on a \"huge pages\" line\n");
+  fprintf(stderr, "  -q name  TLB prefetcher trained on L1 misses: none (default),\n");
+  fprintf(stderr, "           next, stride, distance\n");
+  fprintf(stderr, "  -b N     prefetch buffer entries (default %d)\n", PREFETCH_BUFFER);
+  fprintf(stderr, "  -k N     page faults also map the other non-resident pages of\n");
+  fprintf(stderr, "           their aligned cluster of N pages, a power of two\n");
+  fprintf(stderr, "           prefetching prints walks, issued and useful prefetches,\n");
+  fprintf(stderr, "           accuracy and coverage on \"tlb/fault prefetch\" lines\n");
+  fprintf(stderr, "  -l list  report simulated cycles, AMAT and the share of cycles in\n");
+  fprintf(stderr, "           translation, data, faults and writebacks on a \"timing\"\n");
+  fprintf(stderr, "           line, with these key=cycles costs, comma separated:\n");
+  fprintf(stderr, "           l1, l2, pwc (lookups), walk (page table references),\n");
+  fprintf(stderr, "           mem, fault, disk (writebacks) and queue (writebacks\n");
+  fprintf(stderr, "           in flight, 0 -> synchronous), shootdown and ipi (per\n");
+  fprintf(stderr, "           shootdown and per core interrupted, with -M), e.g.\n");
+  fprintf(stderr, "           -l mem=200,queue=8\n");
+  fprintf(stderr, "  -S list  sampled simulation: of every period accesses the last\n");
+  fprintf(stderr, "           window ones are measured after warmup (default window)\n");
+  fprintf(stderr, "           detailed ones, the rest are simulated but not counted\n");
+  fprintf(stderr, "           or timed; the stats and timing lines are\n");
+  fprintf(stderr, "           extrapolated from the windows, a \"sampling\" line has\n");
+  fprintf(stderr, "           the windows, fast-forwarded accesses and disk writes and\n");
+  fprintf(stderr, "           the TLB miss, fault and disk write rates with their 95%%\n");
+  fprintf(stderr, "           intervals, a \"detailed\" line the counts of the detailed\n");
+  fprintf(stderr, "           accesses (no per process or core lines), e.g. -S 1M,10K\n");
+  fprintf(stderr, "  -i N     record TLB hits and misses, faults, disk writes and free\n");
+  fprintf(stderr, "           frames every N accesses, with a histogram of faults per\n");
+  fprintf(stderr, "           interval (builds with make STATS=1 add victim draws, a\n");
+  fprintf(stderr, "           page reuse histogram and a profile of the access path)\n");
+  fprintf(stderr, "  -o file  write them to file, CSV if it ends in .csv, otherwise\n");
+  fprintf(stderr, "           a JSON object per run (default stdout after the stats)\n");
+  fprintf(stderr, "  -K file  write a checkpoint of the whole simulation to file\n");
+  fprintf(stderr, "  -n N     after N trace records (default 0, before the first)\n");
+  fprintf(stderr, "  -r file  restore a checkpoint and continue with the trace's\n");
+  fprintf(stderr, "           records after it, in the checkpoint's configuration\n");
+  fprintf(stderr, "           (only -i, -o and the timing line of -l still apply)\n");
+  fprintf(stderr, "  -B       print the replay's accesses, seconds, accesses per second\n");
+  fprintf(stderr, "           and ns per access on a \"throughput\" line on stderr\n");
+  fprintf(stderr, "  -s       scalar TLB search, no SSE2/AVX2 kernel\n");
+  fprintf(stderr, "  -C       draw page fault victims with the original rand()\n");
+  fprintf(stderr, "           rejection loop, for results from older versions\n");
+  fprintf(stderr, "  -P list  page replacement policies, comma separated:\n");
+  fprintf(stderr, "           random (default), fifo, clock, aging, opt\n");
+  fprintf(stderr, "           several policies print one stats line each\n");
+  fprintf(stderr, "  -A       no simulation, print the fully associative LRU\n");
+  fprintf(stderr, "           hit/miss curve for every TLB or memory size\n");
+  fprintf(stderr, "  -W file  sweep every config in file (one per line, e.g.\n");
+  fprintf(stderr, "           tlb=64 ways=4 mem=2097152 page=4096 policy=clock)\n");
+  fprintf(stderr, "           and print one CSV line per config\n");
+  fprintf(stderr, "  -j N     sweep workers (default one per core)\n");
+  fprintf(stderr, "  <trace>  text or binary trace, - streams stdin\n");
+}
+
 int main(int argc, char **argv) {
   FILE *input;
+  trace_map_t map;
+  int pipelined = 0;
+  uint tlb_entries = TLB_SIZE, tlb_ways = 0;
+  uint l2_entries = 0, l2_ways = 0;
+  vm_range_t *ranges;
+  int num_ranges;
+  int policy_ids[16] = { POLICY_RANDOM };
+  int num_policies = 1;
+  int analyze = 0;
+  int bench = 0;
+  double start;
+  const char *sweep = NULL;
+  const char *stats_file = NULL;
+  const char *restore_file = NULL;
+  FILE *stats_out = NULL;
+  int stats_csv = 0;
+  int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  int opt;
 
-  if (argc != 2) {
-    fprintf(stderr, "Usage:\n  %s <trace>\n", argv[0]);
+  while ((opt = getopt(argc, argv, "pt:a:T:w:xc:m:g:v:L:F:N:M:IfH:u:R:q:b:k:l:S:i:o:K:n:r:BsCP:AW:j:")) != -1) {
+    switch (opt) {
+      case 'p': pipelined = 1; break;
+      case 't': tlb_entries = strtoul(optarg, NULL, 0); break;
+      case 'a': tlb_ways = strtoul(optarg, NULL, 0); break;
+      case 'T': l2_entries = strtoul(optarg, NULL, 0); break;
+      case 'w': l2_ways = strtoul(optarg, NULL, 0); break;
+      case 'x': vm_config.l2_exclusive = 1; break;
+      case 'c': vm_config.pwc_entries = strtoul(optarg, NULL, 0); break;
+      case 'm': vm_config.mem_size = vm_parse_size(optarg); break;
+      case 'g': vm_config.page_size = vm_parse_size(optarg); break;
+      case 'v': vm_config.va_bits = strtoul(optarg, NULL, 0); break;
+      case 'L': vm_config.pt_levels = strtoul(optarg, NULL, 0); break;
+      case 'F': vm_config.pt_fanout = strtoul(optarg, NULL, 0); break;
+      case 'N': vm_config.max_procs = strtoul(optarg, NULL, 0); break;
+      case 'I': vm_config.inverted = 1; break;
+      case 'M': vm_config.cores = strtoul(optarg, NULL, 0); break;
+      case 'f': vm_config.tlb_flush = 1; break;
+      case 'H': vm_config.huge_size = vm_parse_size(optarg); break;
+      case 'u': vm_config.huge_promote = strtoul(optarg, NULL, 0); break;
+      case 'R':
+        num_ranges = vm_parse_ranges(optarg, &ranges);
+        if (num_ranges < 0) {
+          fprintf(stderr, "Bad address ranges %s!\n", optarg);
+          return 1;
+        }
+        vm_config.huge_ranges = ranges;
+        vm_config.num_huge_ranges = num_ranges;
+        break;
+      case 'q':
+        vm_config.tlb_prefetch = prefetcher_find(optarg);
+        if (vm_config.tlb_prefetch < 0) {
+          fprintf(stderr, "Unknown prefetcher %s!\n", optarg);
+          return 1;
+        }
+        break;
+      case 'b': vm_config.pb_entries = strtoul(optarg, NULL, 0); break;
+      case 'k': vm_config.fault_cluster = strtoul(optarg, NULL, 0); break;
+      case 'l':
+        if (vm_parse_latency(optarg, &vm_config.latency) != 0) {
+          fprintf(stderr, "Bad latencies %s!\n", optarg);
+          return 1;
+        }
+        vm_config.timing = 1;
+        break;
+      case 'S':
+        if (vm_parse_sampling(optarg, &vm_config) != 0) {
+          fprintf(stderr, "Bad sampling %s!\n", optarg);
+          return 1;
+        }
+        break;
+      case 'i': vm_config.interval = strtoull(optarg, NULL, 0); break;
+      case 'o': stats_file = optarg; break;
+      case 'K': checkpoint_file = optarg; break;
+      case 'n': checkpoint_at = strtoull(optarg, NULL, 0); break;
+      case 'r': restore_file = optarg; break;
+      case 's': vm_config.tlb_simd = 0; break;
+      case 'C': vm_config.rand_compat = 1; break;
+      case 'A': analyze = 1; break;
+      case 'B': bench = 1; break;
+      case 'W': sweep = optarg; break;
+      case 'j': jobs = atoi(optarg); break;
+      case 'P':
+        num_policies = parse_policies(optarg, policy_ids, 16);
+        if (!num_policies) {
+          fprintf(stderr, "Unknown policy in %s!\n", optarg);
+          return 1;
+        }
+        break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+  if (optind != argc - 1) {
+    usage(argv[0]);
     return 1;
   }
-
-  input = open_trace(argv[1]);
-  if (!input)
-  {
-    fprintf(stderr, "Trace file %s not found!\n", argv[1]);
+  if ((checkpoint_file || restore_file) && (num_policies > 1 || sweep || analyze)) {
+    fprintf(stderr, "Checkpoints are of a single simulation, not -P lists, -W or -A!\n");
+    return 1;
+  }
+  if (restore_file) {
+    uint64_t position;
+    if (!(vm = vm_restore(restore_file, &vm_config, &position))) {
+      fprintf(stderr, "%s is not a checkpoint!\n", restore_file);
+      return 1;
+    }
+    vm_config = *vmsim_config(vm);
+    skip_records = position;
+    policy_ids[0] = vm_config.policy;
+    if (checkpoint_file && checkpoint_at <= skip_records) {
+      fprintf(stderr, "Checkpoint %s is already past record %zu!\n", restore_file, checkpoint_at);
+      return 1;
+    }
+  }
+  if (!restore_file && vm_config_tlb(&vm_config, tlb_entries, tlb_ways) != 0) {
+    fprintf(stderr, "TLB of %u entries can't be %u way set associative!\n",
+            tlb_entries, tlb_ways);
+    return 1;
+  }
+  if (!restore_file && vm_config_l2_tlb(&vm_config, l2_entries, l2_ways) != 0) {
+    fprintf(stderr, "L2 TLB of %u entries can't be %u way set associative!\n",
+            l2_entries, l2_ways);
+    return 1;
+  }
+  if (vm_geometry(&vm_config, &geo) != 0) {
+    fprintf(stderr, "Can't simulate %llu bytes of %u byte pages with %u bit addresses"
+            " and %u level%s page tables for %u process%s!\n", (counter_t)vm_config.mem_size,
+            vm_config.page_size, vm_config.va_bits, vm_config.pt_levels,
+            vm_config.inverted ? " inverted" : "", vm_config.max_procs,
+            vm_config.max_procs == 1 ? "" : "es");
+    if (vm_config.huge_size) {
+      fprintf(stderr, "(or %llu byte huge pages promoted at %u base pages)\n",
+              (counter_t)vm_config.huge_size, vm_config.huge_promote);
+    }
+    if (vm_config.tlb_prefetch || vm_config.fault_cluster > 1) {
+      fprintf(stderr, "(or a %u entry prefetch buffer and %u page fault clusters)\n",
+              vm_config.pb_entries, vm_config.fault_cluster);
+    }
+    if (vm_config.cores != 1) {
+      fprintf(stderr, "(or %u cores, at most %d)\n", vm_config.cores, VM_MAX_CORES);
+    }
+    if (vm_config.sample_period) {
+      fprintf(stderr, "(or sampling windows of %llu accesses after %llu in periods of %llu)\n",
+              (counter_t)vm_config.sample_window, (counter_t)vm_config.sample_warmup,
+              (counter_t)vm_config.sample_period);
+    }
     return 1;
   }
+  const char *trace = argv[optind];
+
+  if (stats_file) {
+    size_t len = strlen(stats_file);
+    stats_csv = len >= 4 && strcmp(stats_file + len - 4, ".csv") == 0;
+    stats_out = fopen(stats_file, "w");
+    if (!stats_out) {
+      fprintf(stderr, "Can't write statistics to %s!\n", stats_file);
+      return 1;
+    }
+  } else if (vm_config.interval) {
+    stats_out = stdout;
+  }
+
+  int binary = 0;
+  if (strcmp(trace, "-") == 0) {
+    input = stdin;
+    pipelined = 1; // can't rewind or map a pipe
+  } else {
+    binary = trace_map(trace, &map);
+    if (binary < 0) {
+      fprintf(stderr, "Trace file %s is truncated!\n", trace);
+      return 1;
+    }
+    input = binary ? NULL : open_trace(trace);
+    if (!binary && !input)
+    {
+      fprintf(stderr, "Trace file %s not found!\n", trace);
+      return 1;
+    }
+  }
+
+  if (analyze) {
+    size_t n;
+    stack_hist_t hist;
+    const record_t *recs = load_records(input, binary, &map, &n);
+    if (!recs || stack_distances(recs, n, &geo, &hist) != 0) {
+      fprintf(stderr, "Error reading trace %s!\n", trace);
+      return 1;
+    }
+    stack_print_curve(stdout, &hist);
+    stack_free(&hist);
+    return 0;
+  }
 
-  system_init();
-  while (next_line(input));
-  volatile byte_t* mem_ptr = system_shutdown();
-  vm_print_stats(); //Print the stats of the cache
+  if (sweep) {
+    size_t n;
+    FILE *configs = fopen(sweep, "r");
+    if (!configs) {
+      fprintf(stderr, "Config file %s not found!\n", sweep);
+      return 1;
+    }
+    // decode once, every worker reads the same pages
+    const record_t *recs = load_records(input, binary, &map, &n);
+    if (recs && !binary) {
+      const record_t *loaded = recs;
+      recs = sweep_share(loaded, n);
+      free((void *)loaded);
+    }
+    if (!recs) {
+      fprintf(stderr, "Error reading trace %s!\n", trace);
+      return 1;
+    }
+    int failed = sweep_run(configs, recs, n, jobs, stdout);
+    fclose(configs);
+    if (binary) trace_unmap(&map);
+    return failed ? 1 : 0;
+  }
+
+  // several policies or OPT's look ahead -> replay from memory
+  int in_memory = num_policies > 1;
+  for (int i = 0; i < num_policies; i++) {
+    if (policy_ids[i] == POLICY_OPT) in_memory = 1;
+  }
+  if (in_memory) {
+    size_t n;
+    const record_t *recs = load_records(input, binary, &map, &n);
+    if (!recs) {
+      fprintf(stderr, "Error reading trace %s!\n", trace);
+      return 1;
+    }
+    for (int i = 0; i < num_policies; i++) {
+      vm_config.policy = policy_ids[i];
+      if (!restore_file) start_simulation();
+      if (vm_config.policy == POLICY_OPT && policy_set_future(vm, recs, n) != 0) {
+        fprintf(stderr, "Out of memory for OPT's next-use index!\n");
+        return 1;
+      }
+      if (checkpoint_file && checkpoint_at == 0) take_checkpoint();
+      start = now_seconds();
+      replay_records(recs, n);
+      if (bench) print_throughput(now_seconds() - start);
+      if (checkpoint_missed(trace)) return 1;
+      system_shutdown(vm);
+      check_estimates();
+      if (num_policies > 1) printf("%s, ", policies[vm_config.policy].name);
+      vm_print_stats(vm);
+      if (stats_out) stats_write(vm, stats_out, stats_csv);
+    }
+    vmsim_destroy(vm);
+    if (stats_out && stats_out != stdout) fclose(stats_out);
+    if (binary) trace_unmap(&map);
+    if (input && input != stdin) fclose(input);
+    return 0;
+  }
+
+  vm_config.policy = policy_ids[0];
+  if (!restore_file) start_simulation();
+  if (checkpoint_file && checkpoint_at == 0) take_checkpoint();
+  start = now_seconds();
+  if (binary) {
+    replay_records(map.records, map.count);
+    trace_unmap(&map);
+  } else if (pipelined) {
+    if (!replay_stream(input)) {
+      fprintf(stderr, "Error reading trace %s!\n", trace);
+      return 1;
+    }
+  } else {
+    while (next_line(input));
+  }
+  if (bench) print_throughput(now_seconds() - start);
+  if (checkpoint_missed(trace)) return 1;
+  if (input && input != stdin) fclose(input);
+  volatile byte_t* mem_ptr = system_shutdown(vm);
+  check_estimates();
+  vm_print_stats(vm); //Print the stats of the cache
+  if (stats_out) {
+    stats_write(vm, stats_out, stats_csv);
+    if (stats_out != stdout) fclose(stats_out);
+  }
+  vmsim_destroy(vm);
 
 
   return 0;
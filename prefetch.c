@@ -0,0 +1,115 @@
+#include <string.h>
+
+#include "prefetch.h"
+
+static void no_reset(prefetch_state_t* s) {}
+static uint no_miss(prefetch_state_t* s, vpn_t vpn, vpn_t* out) { return 0; }
+
+// ---------------------------------------------------------
+//                      Next page
+// ---------------------------------------------------------
+static uint next_miss(prefetch_state_t* s, vpn_t vpn, vpn_t* out)
+{
+    out[0] = vpn + 1;
+    return 1;
+}
+
+// ---------------------------------------------------------
+//                      Stride
+// ---------------------------------------------------------
+// the distance between the last two misses, once it shows up twice
+// in a row
+static void stride_reset(prefetch_state_t* s)
+{
+    s->stride_last = 0;
+    s->stride_delta = 0;
+}
+
+static uint stride_miss(prefetch_state_t* s, vpn_t vpn, vpn_t* out)
+{
+    int64_t delta = (int64_t)(vpn - s->stride_last);
+    int confirmed = delta != 0 && delta == s->stride_delta;
+    s->stride_last = vpn;
+    s->stride_delta = delta;
+    if (!confirmed) {
+        return 0;
+    }
+    out[0] = vpn + delta;
+    return 1;
+}
+
+// ---------------------------------------------------------
+//                      Distance
+// ---------------------------------------------------------
+// Distances between consecutive misses, each with the two distances
+// that most recently followed it. A miss at distance d prefetches
+// what came after d last time, so repeating patterns of strides
+// are learned, not just a single one.
+// ---------------------------------------------------------
+static distance_row_t* distance_row(prefetch_state_t* s, int64_t d)
+{
+    return &s->distance_table[((uint64_t)d * 0x9E3779B97F4A7C15ULL) >> 56 & (DISTANCE_ROWS - 1)];
+}
+
+static void distance_reset(prefetch_state_t* s)
+{
+    memset(s->distance_table, 0, sizeof(s->distance_table));
+    s->distance_last = 0;
+    s->distance_prev = 0;
+}
+
+static uint distance_miss(prefetch_state_t* s, vpn_t vpn, vpn_t* out)
+{
+    int64_t d = (int64_t)(vpn - s->distance_last);
+    s->distance_last = vpn;
+    // learn: d followed the previous distance
+    distance_row_t* row = distance_row(s, s->distance_prev);
+    if (row->distance != s->distance_prev) {
+        row->distance = s->distance_prev;
+        row->next[0] = row->next[1] = 0;
+    }
+    if (row->next[0] != d) {
+        row->next[1] = row->next[0];
+        row->next[0] = d;
+    }
+    s->distance_prev = d;
+    // predict: what followed d before
+    row = distance_row(s, d);
+    if (row->distance != d) {
+        return 0;
+    }
+    uint n = 0;
+    for (int i = 0; i < 2; i++) {
+        if (row->next[i]) {
+            out[n++] = vpn + row->next[i];
+        }
+    }
+    return n;
+}
+
+// ---------------------------------------------------------
+const prefetcher_t prefetchers[NUM_PREFETCHERS] = {
+    [PREFETCH_NONE] = { "none", no_reset, no_miss },
+    [PREFETCH_NEXT] = { "next", no_reset, next_miss },
+    [PREFETCH_STRIDE] = { "stride", stride_reset, stride_miss },
+    [PREFETCH_DISTANCE] = { "distance", distance_reset, distance_miss },
+};
+
+// save or restore what every prefetcher has learned
+void prefetch_checkpoint(ckpt_t* c, prefetch_state_t* s)
+{
+    CKPT(c, *s);
+}
+
+/*
+* returns the PREFETCH_* with this name, -1 if there is none
+*/
+int prefetcher_find(const char* name)
+{
+    for (int i = 0; i < NUM_PREFETCHERS; i++) {
+        if (strcmp(name, prefetchers[i].name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
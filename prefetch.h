@@ -0,0 +1,46 @@
+#ifndef __PREFETCH_H
+#define __PREFETCH_H
+
+#include "vmsim.h"
+#include "checkpoint.h"
+
+enum { PREFETCH_NONE, PREFETCH_NEXT, PREFETCH_STRIDE, PREFETCH_DISTANCE, NUM_PREFETCHERS };
+
+#define PREFETCH_MAX 4          // VPNs a prefetcher may ask for per miss
+#define PREFETCH_BUFFER 16      // default prefetch buffer entries
+#define DISTANCE_ROWS 256       // distance prefetcher table
+
+// ---------------------------------------------------------
+// TLB prefetcher, trained on the L1 TLB miss stream of VPNs.
+// The translations it asks for are walked (never faulted in) into
+// the prefetch buffer, which L1 misses check before the L2 TLB.
+// ---------------------------------------------------------
+// distance prefetcher: a distance between consecutive misses and the
+// two distances that most recently followed it
+typedef struct distance_row_t {
+    int64_t distance;
+    int64_t next[2];    // most recent first, 0 -> none
+} distance_row_t;
+
+// what the prefetchers have learned, in a simulation's context
+typedef struct prefetch_state_t {
+    vpn_t stride_last;
+    int64_t stride_delta;
+    distance_row_t distance_table[DISTANCE_ROWS];
+    vpn_t distance_last;
+    int64_t distance_prev;
+} prefetch_state_t;
+
+typedef struct prefetcher_t {
+    const char* name;
+    void (*reset)(prefetch_state_t* s);                     // from system_init()
+    uint (*miss)(prefetch_state_t* s, vpn_t vpn, vpn_t* out);   // L1 miss of vpn -> up
+                                                            // to PREFETCH_MAX VPNs in out
+} prefetcher_t;
+
+extern const prefetcher_t prefetchers[NUM_PREFETCHERS];
+
+int prefetcher_find(const char* name);
+void prefetch_checkpoint(ckpt_t* c, prefetch_state_t* s);
+
+#endif
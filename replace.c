@@ -0,0 +1,354 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "context.h"
+#include "trace.h"
+
+static void no_reset(vmsim_ctx* vm) {}
+static void no_map(vmsim_ctx* vm, ppn_t frame) {}
+
+// ---------------------------------------------------------
+//                      Random
+// ---------------------------------------------------------
+/*  ---------------------------------------------------------
+    Draw a random unprotected frame to replace
+    vm_config.rand_compat keeps the original rejection loop over
+    all geo.num_frames frames so runs reproduce the same rand() sequence;
+    otherwise a single draw indexes the evictable list.
+    ---------------------------------------------------------
+*/
+static ppn_t random_victim(vmsim_ctx* vm)
+{
+    if (vm->config.rand_compat) {
+        ppn_t randPage = (vm_rand(vm) % vm->geo.num_frames);
+        STAT_INC(vm->stats.victim_draws);
+        // continue to search for a not protected index
+        while (vm->frametable[randPage].protected) {
+            randPage = (vm_rand(vm) % vm->geo.num_frames);
+            STAT_INC(vm->stats.victim_draws);
+        }
+        return randPage;
+    }
+    STAT_INC(vm->stats.victim_draws);
+    return vm->evictable[vm_rand(vm) % vm->num_evictable];
+}
+
+// ---------------------------------------------------------
+//                      FIFO
+// ---------------------------------------------------------
+// frames in the order they were given their current page, linked
+// through per-frame arrays so a frame can also leave from the middle
+#define FIFO_NIL UINT32_MAX
+
+/*
+* (Re)allocate a per-frame array for the current geometry
+* returns the zeroed array, NULL if out of memory (system_init() fails)
+*/
+static void* frame_array(vmsim_ctx* vm, void* old, size_t size)
+{
+    free(old);
+    void* a = calloc(vm->geo.num_frames, size);
+    if (!a) {
+        vm_fail(vm, "Out of memory for the replacement policy");
+    }
+    return a;
+}
+
+static void fifo_reset(vmsim_ctx* vm)
+{
+    vm->pol.fifo_next = frame_array(vm, vm->pol.fifo_next, sizeof(ppn_t));
+    vm->pol.fifo_prev = frame_array(vm, vm->pol.fifo_prev, sizeof(ppn_t));
+    vm->pol.fifo_queued = frame_array(vm, vm->pol.fifo_queued, sizeof(uint8_t));
+    vm->pol.fifo_head = vm->pol.fifo_tail = FIFO_NIL;
+}
+
+static void fifo_unmap(vmsim_ctx* vm, ppn_t frame)
+{
+    if (!vm->pol.fifo_queued[frame]) {
+        return;
+    }
+    vm->pol.fifo_queued[frame] = 0;
+    ppn_t p = vm->pol.fifo_prev[frame], n = vm->pol.fifo_next[frame];
+    if (p == FIFO_NIL) vm->pol.fifo_head = n; else vm->pol.fifo_next[p] = n;
+    if (n == FIFO_NIL) vm->pol.fifo_tail = p; else vm->pol.fifo_prev[n] = p;
+}
+
+static void fifo_map(vmsim_ctx* vm, ppn_t frame)
+{
+    fifo_unmap(vm, frame);
+    vm->pol.fifo_queued[frame] = 1;
+    vm->pol.fifo_prev[frame] = vm->pol.fifo_tail;
+    vm->pol.fifo_next[frame] = FIFO_NIL;
+    if (vm->pol.fifo_tail == FIFO_NIL) vm->pol.fifo_head = frame; else vm->pol.fifo_next[vm->pol.fifo_tail] = frame;
+    vm->pol.fifo_tail = frame;
+}
+
+static ppn_t fifo_victim(vmsim_ctx* vm)
+{
+    ppn_t frame = vm->pol.fifo_head;
+    fifo_unmap(vm, frame);
+    return frame;   // fifo_map() puts it back at the tail
+}
+
+// ---------------------------------------------------------
+//                      CLOCK
+// ---------------------------------------------------------
+// second chance: the hand sweeps the evictable frames and
+// clears reference bits until it finds one already clear
+
+static void clock_reset(vmsim_ctx* vm)
+{
+    vm->pol.clock_hand = 0;
+}
+
+static void clock_access(vmsim_ctx* vm, ppn_t frame)
+{
+    vm->frametable[frame].referenced = 1;
+}
+
+// the hand must stay inside the shrunk evictable list
+static void clock_pin(vmsim_ctx* vm, ppn_t frame)
+{
+    if (vm->pol.clock_hand >= vm->num_evictable) {
+        vm->pol.clock_hand = 0;
+    }
+}
+
+static ppn_t clock_victim(vmsim_ctx* vm)
+{
+    for (;;) {
+        ppn_t frame = vm->evictable[vm->pol.clock_hand];
+        vm->pol.clock_hand = (vm->pol.clock_hand + 1) % vm->num_evictable;
+        if (!vm->frametable[frame].referenced) {
+            return frame;
+        }
+        vm->frametable[frame].referenced = 0;
+    }
+}
+
+// ---------------------------------------------------------
+//                      Aging (LRU approximation)
+// ---------------------------------------------------------
+// every AGING_PERIOD accesses each frame's age shifts right and
+// takes its reference bit as the new top bit; the victim is the
+// frame with the lowest age
+
+static void aging_reset(vmsim_ctx* vm)
+{
+    vm->pol.aging_age = frame_array(vm, vm->pol.aging_age, sizeof(uint8_t));
+}
+
+static void aging_map(vmsim_ctx* vm, ppn_t frame)
+{
+    vm->pol.aging_age[frame] = 0x80;    // just loaded -> recently used
+    vm->frametable[frame].referenced = 0;
+}
+
+static void aging_access(vmsim_ctx* vm, ppn_t frame)
+{
+    vm->frametable[frame].referenced = 1;
+    if ((vm->count.accesses + vm->count.ff_accesses) % AGING_PERIOD == 0) {
+        for (uint32_t i = 0; i < vm->num_evictable; i++) {
+            ppn_t f = vm->evictable[i];
+            vm->pol.aging_age[f] = vm->pol.aging_age[f] >> 1 | vm->frametable[f].referenced << 7;
+            vm->frametable[f].referenced = 0;
+        }
+    }
+}
+
+static ppn_t aging_victim(vmsim_ctx* vm)
+{
+    ppn_t victim = vm->evictable[0];
+    for (uint32_t i = 1; i < vm->num_evictable; i++) {
+        if (vm->pol.aging_age[vm->evictable[i]] < vm->pol.aging_age[victim]) {
+            victim = vm->evictable[i];
+        }
+    }
+    return victim;
+}
+
+// ---------------------------------------------------------
+//                      OPT (Belady)
+// ---------------------------------------------------------
+// next_use[i] is the index of the next access to the page of
+// record i, built by policy_set_future() in one backwards pass.
+// Resident frames sit in a max-heap keyed by their page's next
+// use, so the victim is the heap top and each access is one
+// O(log frames) key update.
+// ---------------------------------------------------------
+#define NEVER UINT64_MAX
+
+static void heap_swap(policy_state_t* s, uint32_t a, uint32_t b)
+{
+    ppn_t fa = s->opt_heap[a], fb = s->opt_heap[b];
+    s->opt_heap[a] = fb;
+    s->opt_heap[b] = fa;
+    s->opt_pos[fb] = a + 1;
+    s->opt_pos[fa] = b + 1;
+}
+
+static void heap_fix(policy_state_t* s, uint32_t i)
+{
+    // up
+    while (i > 0 && s->opt_key[s->opt_heap[(i - 1) / 2]] < s->opt_key[s->opt_heap[i]]) {
+        heap_swap(s, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    // down
+    for (;;) {
+        uint32_t big = i, l = 2 * i + 1, r = 2 * i + 2;
+        if (l < s->opt_size && s->opt_key[s->opt_heap[l]] > s->opt_key[s->opt_heap[big]]) big = l;
+        if (r < s->opt_size && s->opt_key[s->opt_heap[r]] > s->opt_key[s->opt_heap[big]]) big = r;
+        if (big == i) {
+            return;
+        }
+        heap_swap(s, i, big);
+        i = big;
+    }
+}
+
+static void opt_reset(vmsim_ctx* vm)
+{
+    vm->pol.opt_key = frame_array(vm, vm->pol.opt_key, sizeof(uint64_t));
+    vm->pol.opt_heap = frame_array(vm, vm->pol.opt_heap, sizeof(ppn_t));
+    vm->pol.opt_pos = frame_array(vm, vm->pol.opt_pos, sizeof(int32_t));
+    vm->pol.opt_size = 0;
+}
+
+static void opt_map(vmsim_ctx* vm, ppn_t frame)
+{
+    if (!vm->pol.opt_pos[frame]) {
+        vm->pol.opt_key[frame] = NEVER;
+        vm->pol.opt_heap[vm->pol.opt_size] = frame;
+        vm->pol.opt_pos[frame] = ++vm->pol.opt_size;
+        heap_fix(&vm->pol, vm->pol.opt_size - 1);
+    }
+}
+
+static void opt_access(vmsim_ctx* vm, ppn_t frame)
+{
+    if (!vm->pol.opt_pos[frame]) {
+        return;     // protected
+    }
+    size_t i = vm->count.accesses + vm->count.ff_accesses - 1;    // index of the current record
+    vm->pol.opt_key[frame] = i < vm->pol.future_length ? vm->pol.next_use[i] : NEVER;
+    heap_fix(&vm->pol, vm->pol.opt_pos[frame] - 1);
+}
+
+// a pinned or unmapped frame leaves the heap
+static void opt_remove(vmsim_ctx* vm, ppn_t frame)
+{
+    int32_t i = vm->pol.opt_pos[frame] - 1;
+    if (i < 0) {
+        return;
+    }
+    heap_swap(&vm->pol, i, --vm->pol.opt_size);
+    vm->pol.opt_pos[frame] = 0;
+    if ((uint32_t)i < vm->pol.opt_size) {
+        heap_fix(&vm->pol, i);
+    }
+}
+
+static ppn_t opt_victim(vmsim_ctx* vm)
+{
+    return vm->pol.opt_heap[0];
+}
+
+/*
+* Build OPT's next-use index for the trace about to be replayed
+* Pages are split with the simulation's geometry.
+* returns 0 on success, -1 out of memory
+*/
+int policy_set_future(vmsim_ctx* vm, const record_t* recs, size_t n)
+{
+    free(vm->pol.next_use);
+    vm->pol.next_use = NULL;
+    vm->pol.future_length = 0;
+    size_t pages;
+    uint32_t* page = trace_page_ids(recs, n, vm->geo.page_shift, vm->geo.va_mask, &pages);
+    vm->pol.next_use = malloc((n ? n : 1) * sizeof(uint64_t));
+    uint64_t* last = malloc((pages ? pages : 1) * sizeof(uint64_t));
+    if (!page || !vm->pol.next_use || !last) {
+        free(page);
+        free(last);
+        return -1;
+    }
+    for (size_t p = 0; p < pages; p++) {
+        last[p] = NEVER;
+    }
+    for (size_t i = n; i-- > 0;) {
+        vm->pol.next_use[i] = last[page[i]];
+        last[page[i]] = i;
+    }
+    free(page);
+    free(last);
+    vm->pol.future_length = n;
+    return 0;
+}
+
+// free what every policy allocated, for vmsim_destroy()
+void policy_free(vmsim_ctx* vm)
+{
+    policy_state_t* s = &vm->pol;
+    free(s->fifo_next);
+    free(s->fifo_prev);
+    free(s->fifo_queued);
+    free(s->aging_age);
+    free(s->next_use);
+    free(s->opt_key);
+    free(s->opt_heap);
+    free(s->opt_pos);
+    memset(s, 0, sizeof(*s));
+}
+
+/*
+* Save or restore the running policy's state, after its reset()
+* (OPT's next-use index comes from the trace, not the checkpoint)
+*/
+void policy_checkpoint(ckpt_t* c, vmsim_ctx* vm)
+{
+    switch (vm->config.policy) {
+        case POLICY_FIFO:
+            ckpt_bytes(c, vm->pol.fifo_next, vm->geo.num_frames * sizeof(ppn_t));
+            ckpt_bytes(c, vm->pol.fifo_prev, vm->geo.num_frames * sizeof(ppn_t));
+            ckpt_bytes(c, vm->pol.fifo_queued, vm->geo.num_frames);
+            CKPT(c, vm->pol.fifo_head);
+            CKPT(c, vm->pol.fifo_tail);
+            break;
+        case POLICY_CLOCK:
+            CKPT(c, vm->pol.clock_hand);
+            break;
+        case POLICY_AGING:
+            ckpt_bytes(c, vm->pol.aging_age, vm->geo.num_frames);
+            break;
+        case POLICY_OPT:
+            ckpt_bytes(c, vm->pol.opt_key, vm->geo.num_frames * sizeof(uint64_t));
+            ckpt_bytes(c, vm->pol.opt_heap, vm->geo.num_frames * sizeof(ppn_t));
+            ckpt_bytes(c, vm->pol.opt_pos, vm->geo.num_frames * sizeof(int32_t));
+            CKPT(c, vm->pol.opt_size);
+            break;
+    }
+}
+
+// ---------------------------------------------------------
+const policy_t policies[NUM_POLICIES] = {
+    [POLICY_RANDOM] = { "random", no_reset, no_map, NULL, random_victim, NULL, NULL },
+    [POLICY_FIFO] = { "fifo", fifo_reset, fifo_map, NULL, fifo_victim, fifo_unmap, fifo_unmap },
+    [POLICY_CLOCK] = { "clock", clock_reset, no_map, clock_access, clock_victim, clock_pin, NULL },
+    [POLICY_AGING] = { "aging", aging_reset, aging_map, aging_access, aging_victim, NULL, NULL },
+    [POLICY_OPT] = { "opt", opt_reset, opt_map, opt_access, opt_victim, opt_remove, opt_remove },
+};
+
+/*
+* returns the POLICY_* with this name, -1 if there is none
+*/
+int policy_find(const char* name)
+{
+    for (int i = 0; i < NUM_POLICIES; i++) {
+        if (strcmp(name, policies[i].name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
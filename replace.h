@@ -0,0 +1,54 @@
+#ifndef __REPLACE_H
+#define __REPLACE_H
+
+#include "vmsim.h"
+#include "checkpoint.h"
+
+enum { POLICY_RANDOM, POLICY_FIFO, POLICY_CLOCK, POLICY_AGING, POLICY_OPT, NUM_POLICIES };
+
+#define AGING_PERIOD 1024   // accesses between aging ticks
+
+// ---------------------------------------------------------
+// Page replacement policy, called from page_fault() once memory
+// is full. Only unprotected frames are ever handed to a policy.
+// ---------------------------------------------------------
+typedef struct policy_t {
+    const char* name;
+    void (*reset)(vmsim_ctx* vm);                   // from system_init()
+    void (*map)(vmsim_ctx* vm, ppn_t frame);        // frame was given a new page
+    void (*access)(vmsim_ctx* vm, ppn_t frame);     // every access, NULL if not needed
+    ppn_t (*victim)(vmsim_ctx* vm);                 // frame to replace
+    void (*pin)(vmsim_ctx* vm, ppn_t frame);        // frame left the evictable list (now
+                                                    // a page table), NULL if not needed
+    void (*unmap)(vmsim_ctx* vm, ppn_t frame);      // frame lost its page other than as a
+                                                    // victim (huge pages), NULL if not needed
+} policy_t;
+
+// what the policies keep of a simulation, in its context
+typedef struct policy_state_t {
+    // FIFO: frames in the order they were given their current page
+    ppn_t* fifo_next;
+    ppn_t* fifo_prev;
+    uint8_t* fifo_queued;
+    ppn_t fifo_head, fifo_tail;
+    // CLOCK
+    uint32_t clock_hand;
+    // aging
+    uint8_t* aging_age;
+    // OPT: the trace's next-use index and a max-heap of the frames
+    uint64_t* next_use;
+    size_t future_length;
+    uint64_t* opt_key;
+    ppn_t* opt_heap;
+    int32_t* opt_pos;       // per frame: heap index + 1, 0 -> not in the heap
+    uint32_t opt_size;
+} policy_state_t;
+
+extern const policy_t policies[NUM_POLICIES];
+
+int policy_find(const char* name);
+int policy_set_future(vmsim_ctx* vm, const record_t* recs, size_t n);
+void policy_checkpoint(ckpt_t* c, vmsim_ctx* vm);
+void policy_free(vmsim_ctx* vm);
+
+#endif
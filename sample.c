@@ -0,0 +1,158 @@
+#include <math.h>
+#include <string.h>
+
+#include "context.h"
+
+// counts of the SAMPLE_* events now
+static void sample_counts(const vmsim_ctx* vm, counter_t* c)
+{
+    c[SAMPLE_TLB_MISSES] = vm->count.tlb_misses;
+    c[SAMPLE_PAGE_FAULTS] = vm->count.page_faults;
+    c[SAMPLE_DISK_WRITES] = vm->count.disk_writes;
+    vm_timing_t t;
+    vm_timing(vm, &t);
+    c[SAMPLE_TRANSLATION] = t.translation;
+    c[SAMPLE_DATA] = t.data;
+    c[SAMPLE_FAULTS] = t.faults;
+    c[SAMPLE_WRITEBACKS] = t.writebacks;
+    c[SAMPLE_SHOOTDOWNS] = t.shootdowns;
+}
+
+// where the window begins in a period
+static uint64_t window_start(const vmsim_ctx* vm)
+{
+    return vm->config.sample_period - vm->config.sample_window;
+}
+
+// start over for a new simulation, from system_init() (counters are 0)
+void sample_reset(vmsim_ctx* vm)
+{
+    memset(&vm->sample, 0, sizeof(vm->sample));
+}
+
+/*
+* The phase of the next access
+* returns SAMPLE_*, and in *run how many of the next n accesses are
+* in that phase
+*/
+int sample_phase(const vmsim_ctx* vm, uint64_t n, uint64_t* run)
+{
+    uint64_t window = window_start(vm);
+    uint64_t warmup = window - vm->config.sample_warmup;
+    uint64_t pos = vm->sample.pos;
+    uint64_t end = vm->config.sample_period;
+    int phase = SAMPLE_WINDOW;
+    if (pos < warmup) {
+        phase = SAMPLE_FAST_FORWARD;
+        end = warmup;
+    } else if (pos < window) {
+        phase = SAMPLE_WARMUP;
+        end = window;
+    }
+    *run = end - pos < n ? end - pos : n;
+    return phase;
+}
+
+/*
+* n more accesses were simulated, all in the phase sample_phase()
+* gave: the window begins when they reach it, and its rates are
+* recorded when they end the period
+*/
+void sample_advance(vmsim_ctx* vm, uint64_t n)
+{
+    sample_state_t* s = &vm->sample;
+    s->pos += n;
+    if (s->pos == vm->config.sample_period) {
+        counter_t now[NUM_SAMPLE_EVENTS];
+        sample_counts(vm, now);
+        for (int e = 0; e < NUM_SAMPLE_EVENTS; e++) {
+            double rate = (double)(now[e] - s->start[e]) / vm->config.sample_window;
+            s->sum[e] += rate;
+            s->sum_squares[e] += rate * rate;
+        }
+        s->windows++;
+        s->pos = 0;
+    }
+    if (s->pos == window_start(vm)) {
+        sample_counts(vm, s->start);
+    }
+}
+
+/*
+* Rates per access, see vm_estimate_t
+* The interval is the normal one, 1.96 standard errors of the mean of
+* the windows' rates (0 with fewer than two windows). Before the first
+* window ends (a trace shorter than a period) the rates are those of
+* the detailed accesses so far, as without sampling.
+*/
+void vm_estimate(const vmsim_ctx* vm, vm_estimate_t* e)
+{
+    const sample_state_t* s = &vm->sample;
+    double rate[NUM_SAMPLE_EVENTS], ci[NUM_SAMPLE_EVENTS];
+    e->accesses = vm->count.accesses + vm->count.ff_accesses;
+    e->windows = s->windows;
+    for (int i = 0; i < NUM_SAMPLE_EVENTS; i++) {
+        rate[i] = ci[i] = 0.0;
+    }
+    if (!vm->config.sample_period || !s->windows) {
+        counter_t now[NUM_SAMPLE_EVENTS];
+        sample_counts(vm, now);
+        for (int i = 0; i < NUM_SAMPLE_EVENTS && vm->count.accesses; i++) {
+            rate[i] = (double)now[i] / vm->count.accesses;
+        }
+    } else if (s->windows) {
+        double n = s->windows;
+        for (int i = 0; i < NUM_SAMPLE_EVENTS; i++) {
+            rate[i] = s->sum[i] / n;
+            if (s->windows > 1) {
+                double var = (s->sum_squares[i] - n * rate[i] * rate[i]) / (n - 1);
+                ci[i] = var > 0 ? 1.96 * sqrt(var / n) : 0.0;
+            }
+        }
+    }
+    e->tlb_miss_rate = rate[SAMPLE_TLB_MISSES];
+    e->tlb_miss_ci = ci[SAMPLE_TLB_MISSES];
+    e->fault_rate = rate[SAMPLE_PAGE_FAULTS];
+    e->fault_ci = ci[SAMPLE_PAGE_FAULTS];
+    e->disk_write_rate = rate[SAMPLE_DISK_WRITES];
+    e->disk_write_ci = ci[SAMPLE_DISK_WRITES];
+}
+
+/*
+* vm_timing() of all accesses: without sampling vm_timing() itself,
+* with it each kind of cycle extrapolated from its mean per access
+* in the windows (or, as vm_estimate(), in the detailed accesses)
+*/
+void vm_estimate_timing(const vmsim_ctx* vm, vm_timing_t* t)
+{
+    const sample_state_t* s = &vm->sample;
+    vm_timing(vm, t);
+    if (!vm->config.sample_period) {
+        return;
+    }
+    counter_t accesses = vm->count.accesses + vm->count.ff_accesses;
+    counter_t cycles[NUM_SAMPLE_EVENTS];
+    sample_counts(vm, cycles);
+    for (int i = SAMPLE_TRANSLATION; i < NUM_SAMPLE_EVENTS; i++) {
+        double rate = s->windows ? s->sum[i] / s->windows
+                                 : vm->count.accesses ? (double)cycles[i] / vm->count.accesses : 0.0;
+        cycles[i] = rate * accesses + 0.5;
+    }
+    t->translation = cycles[SAMPLE_TRANSLATION];
+    t->data = cycles[SAMPLE_DATA];
+    t->faults = cycles[SAMPLE_FAULTS];
+    t->writebacks = cycles[SAMPLE_WRITEBACKS];
+    t->shootdowns = cycles[SAMPLE_SHOOTDOWNS];
+    t->cycles = t->translation + t->data + t->faults + t->writebacks + t->shootdowns;
+    t->amat = accesses ? (double)t->cycles / accesses : 0.0;
+}
+
+// the position in the period and the windows so far
+void sample_checkpoint(ckpt_t* c, vmsim_ctx* vm)
+{
+    CKPT(c, vm->sample);
+    if (vm->config.sample_period && vm->sample.pos >= vm->config.sample_period) {
+        c->error = 1;
+        vm->sample.pos = 0;
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef __SAMPLE_H
+#define __SAMPLE_H
+
+#include "vmsim.h"
+#include "checkpoint.h"
+
+// ---------------------------------------------------------
+// Sampled simulation, SMARTS style: each vm_config.sample_period
+// accesses start with a fast-forward, then sample_warmup accesses are
+// simulated in detail and the last sample_window accesses are
+// measured. Fast-forwarded accesses are simulated too, TLBs included
+// (their write-backs decide which dirty bits survive), but aren't
+// counted or timed and don't write mem[]. vm_estimate()
+// turns the windows into rates and confidence intervals,
+// vm_estimate_timing() into cycles.
+// ---------------------------------------------------------
+enum { SAMPLE_FAST_FORWARD, SAMPLE_WARMUP, SAMPLE_WINDOW };
+
+// the events measured in each window, then the vm_timing_t cycles
+enum {
+    SAMPLE_TLB_MISSES, SAMPLE_PAGE_FAULTS, SAMPLE_DISK_WRITES,
+    SAMPLE_TRANSLATION, SAMPLE_DATA, SAMPLE_FAULTS, SAMPLE_WRITEBACKS, SAMPLE_SHOOTDOWNS,
+    NUM_SAMPLE_EVENTS
+};
+
+// the sampling of a simulation, in its context
+typedef struct sample_state_t {
+    uint64_t pos;                           // accesses into the current period
+    counter_t start[NUM_SAMPLE_EVENTS];     // counts when the window began
+    counter_t windows;                      // measured so far
+    double sum[NUM_SAMPLE_EVENTS];          // of their rates per access
+    double sum_squares[NUM_SAMPLE_EVENTS];
+} sample_state_t;
+
+void sample_reset(vmsim_ctx* vm);
+int sample_phase(const vmsim_ctx* vm, uint64_t n, uint64_t* run);
+void sample_advance(vmsim_ctx* vm, uint64_t n);
+void sample_checkpoint(ckpt_t* c, vmsim_ctx* vm);
+
+#endif
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stackdist.h"
+#include "trace.h"
+
+#define NEVER UINT64_MAX
+
+// ---------------------------------------------------------
+// Fenwick tree over access times: bit t is set while t is the
+// latest access of some page, so the number of set bits after
+// a page's previous access is its stack distance (Mattson et al.
+// with Bennett and Kruskal's tree, O(log n) per access).
+// ---------------------------------------------------------
+static void fenwick_add(uint32_t* tree, size_t n, size_t i, int delta)
+{
+    for (i++; i <= n; i += i & -i) {
+        tree[i - 1] += delta;
+    }
+}
+
+// number of set bits in [0, i)
+static uint32_t fenwick_prefix(const uint32_t* tree, size_t i)
+{
+    uint32_t sum = 0;
+    for (; i > 0; i -= i & -i) {
+        sum += tree[i - 1];
+    }
+    return sum;
+}
+
+/*
+* One pass over the trace computing the stack distance of every access
+* Pages are g's pages, addresses are masked to its va_bits.
+* returns 0 on success, -1 out of memory
+*/
+int stack_distances(const record_t* recs, size_t n, const vm_geometry_t* g, stack_hist_t* h)
+{
+    memset(h, 0, sizeof(*h));
+    size_t pages;
+    uint32_t* page = trace_page_ids(recs, n, g->page_shift, g->va_mask, &pages);
+    if (!page) {
+        return -1;
+    }
+    uint32_t* tree = calloc(n ? n : 1, sizeof(uint32_t));
+    uint64_t* last = malloc((pages ? pages : 1) * sizeof(uint64_t));
+    // a distance never exceeds the number of pages
+    h->hist = calloc(pages ? pages : 1, sizeof(counter_t));
+    if (!tree || !last || !h->hist) {
+        free(page);
+        free(tree);
+        free(last);
+        stack_free(h);
+        return -1;
+    }
+    for (size_t p = 0; p < pages; p++) {
+        last[p] = NEVER;
+    }
+    uint32_t live = 0;  // set bits = distinct pages so far
+    for (size_t t = 0; t < n; t++) {
+        uint32_t vpn = page[t];
+        if (last[vpn] == NEVER) {
+            h->cold++;
+            live++;
+        } else {
+            size_t d = live - fenwick_prefix(tree, last[vpn] + 1);
+            h->hist[d]++;
+            if (d >= h->length) {
+                h->length = d + 1;
+            }
+            fenwick_add(tree, n, last[vpn], -1);
+        }
+        fenwick_add(tree, n, t, 1);
+        last[vpn] = t;
+    }
+    h->total = n;
+    free(page);
+    free(tree);
+    free(last);
+    return 0;
+}
+
+/*
+* Hit/miss curve, one line per size up to where it stops changing
+* size is TLB entries or page frames (not counting FT/PT frames),
+* misses are TLB misses or page faults of an LRU structure that big
+*/
+void stack_print_curve(FILE* out, const stack_hist_t* h)
+{
+    counter_t hits = 0;
+    fprintf(out, "size, hits, misses, hit_rate\n");
+    // past size length every reuse hits, only cold misses are left
+    for (size_t s = 1; s <= h->length || s == 1; s++) {
+        hits += h->hist[s - 1];
+        fprintf(out, "%zu, %llu, %llu, %.6f\n", s, hits, h->total - hits,
+                h->total ? (double)hits / h->total : 0.0);
+    }
+}
+
+void stack_free(stack_hist_t* h)
+{
+    free(h->hist);
+    memset(h, 0, sizeof(*h));
+}
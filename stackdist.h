@@ -0,0 +1,26 @@
+#ifndef __STACKDIST_H
+#define __STACKDIST_H
+
+#include <stdio.h>
+
+#include "vmsim.h"
+
+// ---------------------------------------------------------
+// LRU stack distance histogram of the VPN stream
+// hist[d] accesses found d distinct other pages since the last
+// access to the same page, cold accesses had no earlier access.
+// A fully associative LRU structure of S pages (TLB entries or
+// page frames) hits exactly the accesses with d < S.
+// ---------------------------------------------------------
+typedef struct stack_hist_t {
+    counter_t* hist;
+    size_t length;      // largest distance seen + 1
+    counter_t cold;
+    counter_t total;
+} stack_hist_t;
+
+int stack_distances(const record_t* recs, size_t n, const vm_geometry_t* g, stack_hist_t* h);
+void stack_print_curve(FILE* out, const stack_hist_t* h);
+void stack_free(stack_hist_t* h);
+
+#endif
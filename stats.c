@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "context.h"
+
+#ifdef VMSIM_STATS
+static const char* prof_names[NUM_PROFS] = { "check_TLB", "check_PT", "update_TLB", "page_fault" };
+#endif
+
+// cumulative counts now
+static void stats_now(vmsim_ctx* vm, stats_interval_t* s)
+{
+    s->accesses = vm->count.accesses;
+    s->tlb_hits = vm->count.tlb_hits;
+    s->tlb_misses = vm->count.tlb_misses;
+    s->page_faults = vm->count.page_faults;
+    s->disk_writes = vm->count.disk_writes;
+#ifdef VMSIM_STATS
+    s->victim_draws = vm->stats.victim_draws;
+#else
+    s->victim_draws = 0;
+#endif
+    s->free_frames = vm_free_frames(vm);
+}
+
+/*
+* Start over for a new simulation, from system_init() (and intervals
+* from where a restored checkpoint left off)
+* Out of memory fails system_init().
+*/
+void stats_reset(vmsim_ctx* vm)
+{
+    stats_state_t* st = &vm->stats;
+    free(st->intervals);
+    st->intervals = NULL;
+    st->num_intervals = st->intervals_cap = 0;
+    stats_now(vm, &st->interval_start);
+    st->next = vm->config.interval ? vm->count.accesses + vm->config.interval : ~0ULL;
+#ifdef VMSIM_STATS
+    st->victim_draws = 0;
+    free(st->reuse_key);
+    free(st->reuse_time);
+    st->reuse_key = calloc(vm->geo.num_frames, sizeof(vpn_t));
+    st->reuse_time = calloc(vm->geo.num_frames, sizeof(counter_t));
+    if (!st->reuse_key || !st->reuse_time) {
+        vm_fail(vm, "Out of memory for the reuse histogram");
+    }
+    memset(st->reuse_hist, 0, sizeof(st->reuse_hist));
+    st->reuse_cold = 0;
+    memset(st->prof_calls, 0, sizeof(st->prof_calls));
+    memset(st->prof_ns, 0, sizeof(st->prof_ns));
+#endif
+}
+
+// free the intervals and histograms, for vmsim_destroy()
+void stats_free(vmsim_ctx* vm)
+{
+    free(vm->stats.intervals);
+#ifdef VMSIM_STATS
+    free(vm->stats.reuse_key);
+    free(vm->stats.reuse_time);
+#endif
+    memset(&vm->stats, 0, sizeof(vm->stats));
+}
+
+/*
+* Record the interval that ends now
+* Called when accesses reaches stats_next, and once more by
+* stats_write() for what is left.
+*/
+void stats_interval(vmsim_ctx* vm)
+{
+    stats_state_t* st = &vm->stats;
+    if (st->num_intervals == st->intervals_cap) {
+        size_t cap = st->intervals_cap ? 2 * st->intervals_cap : 256;
+        stats_interval_t* grown = realloc(st->intervals, cap * sizeof(stats_interval_t));
+        if (!grown) {
+            vm_fail(vm, "Out of memory for interval statistics");
+            return;
+        }
+        st->intervals = grown;
+        st->intervals_cap = cap;
+    }
+    stats_interval_t now;
+    stats_now(vm, &now);
+    stats_interval_t* s = &st->intervals[st->num_intervals++];
+    s->accesses = now.accesses - st->interval_start.accesses;
+    s->tlb_hits = now.tlb_hits - st->interval_start.tlb_hits;
+    s->tlb_misses = now.tlb_misses - st->interval_start.tlb_misses;
+    s->page_faults = now.page_faults - st->interval_start.page_faults;
+    s->disk_writes = now.disk_writes - st->interval_start.disk_writes;
+    s->victim_draws = now.victim_draws - st->interval_start.victim_draws;
+    s->free_frames = now.free_frames;
+    st->interval_start = now;
+    if (vm->config.interval) {
+        st->next = vm->count.accesses + vm->config.interval;
+    }
+}
+
+#ifdef VMSIM_STATS
+// an access to ppn, fault -> its page was just brought in
+void stats_reuse(vmsim_ctx* vm, ppn_t ppn, int fault)
+{
+    stats_state_t* st = &vm->stats;
+    vpn_t key = (vpn_t)vm->frametable[ppn].asid << VPN_BITS | vm->frametable[ppn].vpn;
+    if (fault || st->reuse_key[ppn] != key || !st->reuse_time[ppn]) {
+        st->reuse_cold++;
+    } else {
+        counter_t d = vm->count.accesses - st->reuse_time[ppn];
+        st->reuse_hist[d ? 64 - __builtin_clzll(d) : 0]++;
+    }
+    st->reuse_key[ppn] = key;
+    st->reuse_time[ppn] = vm->count.accesses;
+}
+
+void stats_prof_begin(vmsim_ctx* vm, int p)
+{
+    clock_gettime(CLOCK_MONOTONIC, &vm->stats.prof_start[p]);
+}
+
+void stats_prof_end(vmsim_ctx* vm, int p)
+{
+    stats_state_t* st = &vm->stats;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    st->prof_calls[p]++;
+    st->prof_ns[p] += (end.tv_sec - st->prof_start[p].tv_sec) * 1000000000LL +
+                      (end.tv_nsec - st->prof_start[p].tv_nsec);
+}
+#endif
+
+// ---------------------------------------------------------
+//                      Output
+// ---------------------------------------------------------
+// Bucket k of a histogram counts values in [2^(k-1), 2^k), bucket 0
+// zeros; buckets are written as low, high (inclusive), count up to
+// the last one that isn't empty.
+// JSON: one object per simulation on a line of its own
+// CSV: a table of the intervals, a blank line and a table of the
+// histograms, each with a header line
+// ---------------------------------------------------------
+static int hist_length(const counter_t* hist)
+{
+    int n = STATS_BUCKETS;
+    while (n > 0 && !hist[n - 1]) {
+        n--;
+    }
+    return n;
+}
+
+static counter_t bucket_low(int k)
+{
+    return k ? 1ULL << (k - 1) : 0;
+}
+
+static counter_t bucket_high(int k)
+{
+    return k ? (bucket_low(k) << 1) - 1 : 0;
+}
+
+static void json_hist(FILE* out, const counter_t* hist)
+{
+    int n = hist_length(hist);
+    fprintf(out, "[");
+    for (int k = 0; k < n; k++) {
+        fprintf(out, "%s[%llu, %llu, %llu]", k ? ", " : "", bucket_low(k), bucket_high(k), hist[k]);
+    }
+    fprintf(out, "]");
+}
+
+static void csv_hist(vmsim_ctx* vm, FILE* out, const char* name, const counter_t* hist)
+{
+    int n = hist_length(hist);
+    for (int k = 0; k < n; k++) {
+        fprintf(out, "%s, %s, %llu, %llu, %llu\n", policies[vm->config.policy].name, name,
+                bucket_low(k), bucket_high(k), hist[k]);
+    }
+}
+
+/*
+* Write the intervals and histograms of the simulation that just ran
+* csv -> CSV, otherwise JSON
+*/
+void stats_write(vmsim_ctx* vm, FILE* out, int csv)
+{
+    stats_state_t* st = &vm->stats;
+    if (!st->num_intervals || vm->count.accesses > st->interval_start.accesses) {
+        stats_interval(vm);
+    }
+    counter_t faults_hist[STATS_BUCKETS] = { 0 };
+    for (size_t i = 0; i < st->num_intervals; i++) {
+        counter_t f = st->intervals[i].page_faults;
+        faults_hist[f ? 64 - __builtin_clzll(f) : 0]++;
+    }
+    const char* name = policies[vm->config.policy].name;
+#ifdef VMSIM_STATS
+    int draws = 1;
+#else
+    int draws = 0;
+#endif
+    if (csv) {
+        fprintf(out, "policy, interval, accesses, tlb_hits, tlb_misses, page_faults, disk_writes, "
+                     "free_frames%s\n", draws ? ", victim_draws" : "");
+        for (size_t i = 0; i < st->num_intervals; i++) {
+            const stats_interval_t* s = &st->intervals[i];
+            fprintf(out, "%s, %zu, %llu, %llu, %llu, %llu, %llu, %u", name, i, s->accesses,
+                    s->tlb_hits, s->tlb_misses, s->page_faults, s->disk_writes, s->free_frames);
+            if (draws) {
+                fprintf(out, ", %llu", s->victim_draws);
+            }
+            fprintf(out, "\n");
+        }
+        fprintf(out, "\npolicy, histogram, low, high, count\n");
+        csv_hist(vm, out, "faults_per_interval", faults_hist);
+#ifdef VMSIM_STATS
+        fprintf(out, "%s, reuse_cold, 0, 0, %llu\n", name, st->reuse_cold);
+        csv_hist(vm, out, "reuse", st->reuse_hist);
+        fprintf(out, "\npolicy, function, calls, seconds\n");
+        for (int p = 0; p < NUM_PROFS; p++) {
+            fprintf(out, "%s, %s, %llu, %.6f\n", name, prof_names[p], st->prof_calls[p], st->prof_ns[p] / 1e9);
+        }
+#endif
+        return;
+    }
+    fprintf(out, "{\"policy\": \"%s\", \"interval\": %llu, \"intervals\": [", name,
+            (counter_t)vm->config.interval);
+    for (size_t i = 0; i < st->num_intervals; i++) {
+        const stats_interval_t* s = &st->intervals[i];
+        fprintf(out, "%s{\"accesses\": %llu, \"tlb_hits\": %llu, \"tlb_misses\": %llu, "
+                     "\"page_faults\": %llu, \"disk_writes\": %llu, \"free_frames\": %u",
+                i ? ", " : "", s->accesses, s->tlb_hits, s->tlb_misses, s->page_faults,
+                s->disk_writes, s->free_frames);
+        if (draws) {
+            fprintf(out, ", \"victim_draws\": %llu", s->victim_draws);
+        }
+        fprintf(out, "}");
+    }
+    fprintf(out, "], \"faults_per_interval\": ");
+    json_hist(out, faults_hist);
+#ifdef VMSIM_STATS
+    fprintf(out, ", \"reuse\": {\"cold\": %llu, \"buckets\": ", st->reuse_cold);
+    json_hist(out, st->reuse_hist);
+    fprintf(out, "}, \"profile\": {");
+    for (int p = 0; p < NUM_PROFS; p++) {
+        fprintf(out, "%s\"%s\": {\"calls\": %llu, \"seconds\": %.6f}", p ? ", " : "",
+                prof_names[p], st->prof_calls[p], st->prof_ns[p] / 1e9);
+    }
+    fprintf(out, "}");
+#endif
+    fprintf(out, "}\n");
+}
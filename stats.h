@@ -0,0 +1,76 @@
+#ifndef __STATS_H
+#define __STATS_H
+
+#include <stdio.h>
+#include <time.h>
+
+#include "vmsim.h"
+
+#define STATS_BUCKETS 65    // log2 histogram buckets: 0, then [2^(k-1), 2^k)
+
+enum { PROF_CHECK_TLB, PROF_CHECK_PT, PROF_UPDATE_TLB, PROF_PAGE_FAULT, NUM_PROFS };
+
+// ---------------------------------------------------------
+// Interval statistics: every vm_config.interval accesses the event
+// counts since the last interval end are recorded, with the free
+// frames at its end. stats_write() adds a last partial interval and
+// the histogram of page faults per interval.
+// ---------------------------------------------------------
+typedef struct stats_interval_t {
+    counter_t accesses, tlb_hits, tlb_misses, page_faults, disk_writes;
+    counter_t victim_draws;     // rand() calls for victims, VMSIM_STATS builds
+    uint32_t free_frames;
+} stats_interval_t;
+
+// the statistics of a simulation, in its context
+typedef struct stats_state_t {
+    counter_t next;                 // accesses at the next interval end
+    stats_interval_t* intervals;
+    size_t num_intervals, intervals_cap;
+    stats_interval_t interval_start;    // cumulative counts at the last interval end
+#ifdef VMSIM_STATS
+    counter_t victim_draws;
+    // reuse: per frame the page (ASID << VPN_BITS | VPN) last accessed in it
+    // and when, accesses since then by log2 bucket
+    vpn_t* reuse_key;
+    counter_t* reuse_time;
+    counter_t reuse_hist[STATS_BUCKETS];
+    counter_t reuse_cold;
+    // profile: calls and nanoseconds by PROF_*
+    struct timespec prof_start[NUM_PROFS];
+    counter_t prof_calls[NUM_PROFS], prof_ns[NUM_PROFS];
+#endif
+} stats_state_t;
+
+void stats_reset(vmsim_ctx* vm);
+void stats_free(vmsim_ctx* vm);
+void stats_interval(vmsim_ctx* vm);
+void stats_write(vmsim_ctx* vm, FILE* out, int csv);
+
+// ---------------------------------------------------------
+// Hot path instrumentation, compiled in with -DVMSIM_STATS (make
+// STATS=1) and empty otherwise:
+//   STAT_INC      counters (random victim draws)
+//   STAT_REUSE    histogram of accesses between two accesses to a
+//                 page while it stays in its frame
+//   PROF_BEGIN/END  wall clock time in check_TLB(), check_PT(),
+//                 update_TLB() and page_fault(), inclusive
+// Batched accesses go through memory_access() in these builds.
+// ---------------------------------------------------------
+#ifdef VMSIM_STATS
+void stats_reuse(vmsim_ctx* vm, ppn_t ppn, int fault);
+void stats_prof_begin(vmsim_ctx* vm, int p);
+void stats_prof_end(vmsim_ctx* vm, int p);
+
+#define STAT_INC(c) ((c)++)
+#define STAT_REUSE(vm, ppn, fault) stats_reuse(vm, ppn, fault)
+#define PROF_BEGIN(vm, p) stats_prof_begin(vm, p)
+#define PROF_END(vm, p) stats_prof_end(vm, p)
+#else
+#define STAT_INC(c) ((void)0)
+#define STAT_REUSE(vm, ppn, fault) ((void)0)
+#define PROF_BEGIN(vm, p) ((void)0)
+#define PROF_END(vm, p) ((void)0)
+#endif
+
+#endif
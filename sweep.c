@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "sweep.h"
+#include "replace.h"
+#include "prefetch.h"
+
+#define SWEEP_LINE 1024 // result slot, one CSV line
+
+typedef struct sweep_config_t {
+    vm_config_t vm;
+    uint tlb_entries;
+    uint l2_entries;
+} sweep_config_t;
+
+/*
+* Parse one config line into cfg, starting from the defaults
+* returns 1 for a config, 0 for a blank/comment line, -1 on an error
+*/
+static int parse_config(char* line, sweep_config_t* cfg)
+{
+    vm_config_t defaults = VM_CONFIG_DEFAULT;
+    cfg->vm = defaults;
+    cfg->tlb_entries = TLB_SIZE;
+    cfg->l2_entries = 0;
+    uint ways = 0, l2_ways = 0;
+    char* hash = strchr(line, '#');
+    if (hash) {
+        *hash = 0;
+    }
+    int fields = 0;
+    for (char* tok = strtok(line, " \t\r\n"); tok; tok = strtok(NULL, " \t\r\n")) {
+        char* eq = strchr(tok, '=');
+        if (!eq) {
+            return -1;
+        }
+        *eq = 0;
+        const char* key = tok;
+        const char* val = eq + 1;
+        if (strcmp(key, "tlb") == 0) {
+            cfg->tlb_entries = strtoul(val, NULL, 0);
+        } else if (strcmp(key, "ways") == 0) {
+            ways = strtoul(val, NULL, 0);
+        } else if (strcmp(key, "mem") == 0) {
+            cfg->vm.mem_size = vm_parse_size(val);
+        } else if (strcmp(key, "page") == 0) {
+            cfg->vm.page_size = vm_parse_size(val);
+        } else if (strcmp(key, "va") == 0) {
+            cfg->vm.va_bits = strtoul(val, NULL, 0);
+        } else if (strcmp(key, "levels") == 0) {
+            cfg->vm.pt_levels = strtoul(val, NULL, 0);
+        } else if (strcmp(key, "fanout") == 0) {
+            cfg->vm.pt_fanout = strtoul(val, NULL, 0);
+        } else if (strcmp(key, "procs") == 0) {
+            cfg->vm.max_procs = strtoul(val, NULL, 0);
+        } else if (strcmp(key, "inverted") == 0) {
+            cfg->vm.inverted = atoi(val);
+        } else if (strcmp(key, "cores") == 0) {
+            cfg->vm.cores = strtoul(val, NULL, 0);
+        } else if (strcmp(key, "flush") == 0) {
+            cfg->vm.tlb_flush = atoi(val);
+        } else if (strcmp(key, "policy") == 0) {
+            if ((cfg->vm.policy = policy_find(val)) < 0) {
+                return -1;
+            }
+        } else if (strcmp(key, "l2") == 0) {
+            cfg->l2_entries = strtoul(val, NULL, 0);
+        } else if (strcmp(key, "l2ways") == 0) {
+            l2_ways = strtoul(val, NULL, 0);
+        } else if (strcmp(key, "exclusive") == 0) {
+            cfg->vm.l2_exclusive = atoi(val);
+        } else if (strcmp(key, "pwc") == 0) {
+            cfg->vm.pwc_entries = strtoul(val, NULL, 0);
+        } else if (strcmp(key, "huge") == 0) {
+            cfg->vm.huge_size = vm_parse_size(val);
+        } else if (strcmp(key, "promote") == 0) {
+            cfg->vm.huge_promote = strtoul(val, NULL, 0);
+        } else if (strcmp(key, "prefetch") == 0) {
+            if ((cfg->vm.tlb_prefetch = prefetcher_find(val)) < 0) {
+                return -1;
+            }
+        } else if (strcmp(key, "pb") == 0) {
+            cfg->vm.pb_entries = strtoul(val, NULL, 0);
+        } else if (strcmp(key, "cluster") == 0) {
+            cfg->vm.fault_cluster = strtoul(val, NULL, 0);
+        } else if (strcmp(key, "latency") == 0) {
+            if (vm_parse_latency(val, &cfg->vm.latency) != 0) {
+                return -1;
+            }
+        } else if (strcmp(key, "sample") == 0) {
+            if (vm_parse_sampling(val, &cfg->vm) != 0) {
+                return -1;
+            }
+        } else if (strcmp(key, "compat") == 0) {
+            cfg->vm.rand_compat = atoi(val);
+        } else if (strcmp(key, "seed") == 0) {
+            cfg->vm.seed = strtoul(val, NULL, 0);
+        } else {
+            return -1;
+        }
+        fields++;
+    }
+    if (!fields) {
+        return 0;
+    }
+    if (vm_config_tlb(&cfg->vm, cfg->tlb_entries, ways) != 0 ||
+        vm_config_l2_tlb(&cfg->vm, cfg->l2_entries, l2_ways) != 0 ||
+        vm_config_check(&cfg->vm) != 0) {
+        return -1;
+    }
+    return 1;
+}
+
+/*
+* Copy a decoded trace into a read-only shared mapping so every
+* worker reads the same physical pages
+* returns the copy, NULL if the mapping failed
+*/
+const record_t* sweep_share(const record_t* recs, size_t n)
+{
+    size_t len = (n ? n : 1) * sizeof(record_t);
+    void* shared = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        return NULL;
+    }
+    memcpy(shared, recs, n * sizeof(record_t));
+    mprotect(shared, len, PROT_READ);
+    return shared;
+}
+
+// one simulation, in a worker process
+static void run_config(const sweep_config_t* cfg, const record_t* recs, size_t n, char* result)
+{
+    const vm_config_t* c = &cfg->vm;
+    vmsim_ctx* vm = vmsim_create(c);
+    if (!vm || (c->policy == POLICY_OPT && policy_set_future(vm, recs, n) != 0)) {
+        vmsim_destroy(vm);
+        snprintf(result, SWEEP_LINE, "error: out of memory\n");
+        return;
+    }
+    if (memory_access_batch(vm, recs, n, NULL) != 0) {
+        uint64_t record = 0;
+        const char* error = vmsim_error(vm, &record);
+        snprintf(result, SWEEP_LINE, "error: %s after %llu records\n", error, (counter_t)record);
+        vmsim_destroy(vm);
+        return;
+    }
+    system_shutdown(vm);
+    const vm_counters_t* k = vmsim_counters(vm);
+    if (k->ff_accesses && !k->accesses) {
+        snprintf(result, SWEEP_LINE, "error: no access was simulated in detail, the trace is shorter than a sampling period\n");
+        vmsim_destroy(vm);
+        return;
+    }
+    // config columns, then stats
+    int len = snprintf(result, SWEEP_LINE, "%u, %u, %u, %u, %d, %u, %llu, %u, %u, %u, %d, "
+                       "%llu, %u, %s, %u, %u, %u, %s, %u, %d, %llu, ",
+                       cfg->tlb_entries, c->tlb_ways, cfg->l2_entries, c->l2_ways,
+                       c->l2_exclusive, c->pwc_entries, (counter_t)c->mem_size,
+                       c->page_size, c->va_bits, c->pt_levels,
+                       c->tlb_flush, (counter_t)c->huge_size, vmsim_geometry(vm)->huge_promote,
+                       prefetchers[c->tlb_prefetch].name, c->pb_entries,
+                       c->fault_cluster, c->latency.queue,
+                       policies[c->policy].name, c->cores, c->inverted, (counter_t)c->sample_period);
+    vm_timing_t t;
+    vm_estimate_timing(vm, &t);
+    vm_estimate_t e;
+    vm_estimate(vm, &e);
+    // sampled: the stats line's counts and the cycles extrapolated as
+    // vmsim prints them, the other counts of the detailed accesses only
+    counter_t accesses = k->accesses, hits = k->tlb_hits, misses = k->tlb_misses;
+    counter_t faults = k->page_faults, disk_writes = k->disk_writes;
+    if (c->sample_period) {
+        accesses = e.accesses;
+        misses = e.tlb_miss_rate * e.accesses + 0.5;
+        hits = accesses - misses;
+        faults = e.fault_rate * e.accesses + 0.5;
+        disk_writes = e.disk_write_rate * e.accesses + 0.5;
+    }
+    len += snprintf(result + len, SWEEP_LINE - len,
+             "%llu, %llu, %llu, %llu, %llu, %llu, %llu, %llu, %llu, %llu, %llu, %llu, %llu, "
+             "%llu, %llu, %llu, %llu, %llu, %llu, %llu, %llu, "
+             "%llu, %.2f, %llu, %llu, %llu, %llu, %llu, %llu, %llu, %llu, %u, ",
+             accesses, hits, misses, faults, disk_writes,
+             k->shutdown_writes, k->l2_tlb_hits, k->l2_tlb_misses, k->pwc_hits, k->pwc_misses,
+             k->pt_walk_refs, k->pt_table_frames, k->context_switches, k->huge_tlb_hits,
+             k->huge_promotions, k->huge_demotions, k->tlb_prefetch_walks, k->tlb_prefetches,
+             k->tlb_prefetch_hits, k->fault_prefetches, k->fault_prefetch_hits, t.cycles, t.amat,
+             t.translation, t.data, t.faults, t.writebacks, k->shootdowns, k->shootdown_ipis,
+             t.shootdowns, k->ipt_probes, vmsim_geometry(vm)->pt_frames);
+    // sampling estimates, the exact rates without it
+    snprintf(result + len, SWEEP_LINE - len, "%llu, %llu, %llu, %llu, %.6f, %.6f, %.6f, %.6f, %.6f, %.6f\n",
+             k->accesses, k->ff_accesses, k->ff_disk_writes, e.windows, e.tlb_miss_rate, e.tlb_miss_ci, e.fault_rate, e.fault_ci,
+             e.disk_write_rate, e.disk_write_ci);
+    vmsim_destroy(vm);
+}
+
+/*
+* Run every config in the configs file over recs, at most jobs at a time
+* Results are written to out as CSV in config file order.
+* recs must already be shared (a mapped binary trace or sweep_share())
+* returns 0 on success, -1 on a bad config file or a failed worker
+*/
+int sweep_run(FILE* configs, const record_t* recs, size_t n, int jobs, FILE* out)
+{
+    static sweep_config_t cfg[SWEEP_MAX_CONFIGS];
+    int count = 0;
+    char line[1024];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), configs)) {
+        lineno++;
+        if (count == SWEEP_MAX_CONFIGS) {
+            fprintf(stderr, "More than %d configs!\n", SWEEP_MAX_CONFIGS);
+            return -1;
+        }
+        int r = parse_config(line, &cfg[count]);
+        if (r < 0) {
+            fprintf(stderr, "Bad config on line %d!\n", lineno);
+            return -1;
+        }
+        count += r;
+    }
+    // workers write their line into their own slot
+    char* results = mmap(NULL, (size_t)(count ? count : 1) * SWEEP_LINE,
+                         PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED) {
+        return -1;
+    }
+    if (jobs < 1) {
+        jobs = 1;
+    }
+    fflush(out);
+    int running = 0, failed = 0;
+    for (int i = 0; i < count || running > 0;) {
+        if (i < count && running < jobs) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                run_config(&cfg[i], recs, n, results + (size_t)i * SWEEP_LINE);
+                _exit(0);
+            }
+            if (pid < 0) {
+                failed = 1;
+                break;
+            }
+            running++;
+            i++;
+            continue;
+        }
+        int status;
+        if (wait(&status) < 0) {
+            break;
+        }
+        running--;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            failed = 1;
+        }
+    }
+    while (running > 0 && wait(NULL) > 0) {
+        running--;
+    }
+    fprintf(out, "tlb_entries, tlb_ways, l2_entries, l2_ways, l2_exclusive, pwc_entries, "
+                 "mem_size, page_size, va_bits, pt_levels, tlb_flush, huge_size, huge_promote, "
+                 "prefetcher, pb_entries, fault_cluster, wb_queue, policy, cores, inverted, "
+                 "sample_period, "
+                 "accesses, tlb_hits, tlb_misses, page_faults, disk_writes, shutdown_writes, "
+                 "l2_hits, l2_misses, pwc_hits, pwc_misses, walk_refs, table_frames, "
+                 "context_switches, huge_hits, promotions, splits, "
+                 "prefetch_walks, prefetches, prefetch_hits, fault_prefetches, "
+                 "fault_prefetch_hits, cycles, amat, translation_cycles, data_cycles, "
+                 "fault_cycles, writeback_cycles, shootdowns, shootdown_ipis, "
+                 "shootdown_cycles, ipt_probes, pt_frames, detailed_accesses, ff_accesses, "
+                 "ff_disk_writes, "
+                 "sample_windows, "
+                 "tlb_miss_rate, tlb_miss_ci, fault_rate, fault_ci, disk_write_rate, "
+                 "disk_write_ci\n");
+    for (int i = 0; i < count; i++) {
+        const char* r = results + (size_t)i * SWEEP_LINE;
+        if (!r[0] || strncmp(r, "error", 5) == 0) {
+            if (r[0]) {
+                fprintf(stderr, "Config %d %s", i + 1, r);
+            }
+            failed = 1;
+            continue;
+        }
+        fputs(r, out);
+    }
+    munmap(results, (size_t)(count ? count : 1) * SWEEP_LINE);
+    return failed ? -1 : 0;
+}
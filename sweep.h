@@ -0,0 +1,32 @@
+#ifndef __SWEEP_H
+#define __SWEEP_H
+
+#include <stdio.h>
+
+#include "vmsim.h"
+
+// ---------------------------------------------------------
+// Parameter sweep: every configuration in a list runs over the
+// same decoded trace, one worker process (and core) per config.
+// Config files hold one configuration per line, e.g.
+//   tlb=64 ways=4 mem=2097152 page=4096 policy=clock
+// (mem and page take K/M/G suffixes, va is the address width,
+// levels and fanout shape the page table, inverted=1 makes it a hashed
+// inverted one, procs, cores and flush set up multi-process and
+// multi-core traces, l2, l2ways, exclusive and pwc add an L2 TLB
+// and a page walk cache, huge and promote set huge pages up, prefetch,
+// pb and cluster the TLB prefetcher, its buffer and fault read-around,
+// latency the costs of the timing model like vmsim -l, e.g.
+// latency=mem=200,queue=8, and sample=period,window[,warmup]
+// sampling like vmsim -S)
+// with anything left out at its default and # starting a comment.
+// Sampled rows extrapolate accesses, tlb_hits, tlb_misses, page_faults,
+// disk_writes and the cycles from the windows; their other counts are
+// those of the detailed_accesses.
+// ---------------------------------------------------------
+#define SWEEP_MAX_CONFIGS 4096
+
+int sweep_run(FILE* configs, const record_t* recs, size_t n, int jobs, FILE* out);
+const record_t* sweep_share(const record_t* recs, size_t n);
+
+#endif
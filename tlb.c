@@ -0,0 +1,264 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "tlb.h"
+
+// ---------------------------------------------------------
+//                  Tag search kernels
+// ---------------------------------------------------------
+static uint32_t find_scalar(const uint64_t* tags, uint32_t n, uint64_t key)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        if (tags[i] == key) {
+            return i;
+        }
+    }
+    return TLB_NIL;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+// 4 x 2 tags per iteration, SSE2 has no 64 bit compare: a tag
+// matches when both of its 32 bit halves do
+__attribute__((target("sse2")))
+static uint32_t find_sse2(const uint64_t* tags, uint32_t n, uint64_t key)
+{
+    __m128i k = _mm_set1_epi64x(key);
+    for (uint32_t i = 0; i < n; i += 8) {
+        int m = 0;
+        for (int v = 0; v < 4; v++) {
+            __m128i c = _mm_cmpeq_epi32(_mm_load_si128((const __m128i*)(tags + i + 2 * v)), k);
+            c = _mm_and_si128(c, _mm_shuffle_epi32(c, _MM_SHUFFLE(2, 3, 0, 1)));
+            m |= _mm_movemask_pd(_mm_castsi128_pd(c)) << (2 * v);
+        }
+        if (m) {
+            return i + __builtin_ctz(m);
+        }
+    }
+    return TLB_NIL;
+}
+
+// 4 tags per compare, two compares folded per branch
+__attribute__((target("avx2")))
+static uint32_t find_avx2(const uint64_t* tags, uint32_t n, uint64_t key)
+{
+    __m256i k = _mm256_set1_epi64x(key);
+    for (uint32_t i = 0; i < n; i += 8) {
+        __m256i a = _mm256_cmpeq_epi64(_mm256_load_si256((const __m256i*)(tags + i)), k);
+        __m256i b = _mm256_cmpeq_epi64(_mm256_load_si256((const __m256i*)(tags + i + 4)), k);
+        if (!_mm256_testz_si256(_mm256_or_si256(a, b), _mm256_or_si256(a, b))) {
+            uint32_t m = (uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(a)) |
+                         (uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(b)) << 4;
+            return i + __builtin_ctz(m);
+        }
+    }
+    return TLB_NIL;
+}
+#endif
+
+static void pick_kernel(tlb_t* tlb, int simd)
+{
+    tlb->find = find_scalar;
+    tlb->kernel = "scalar";
+#if defined(__x86_64__) || defined(__i386__)
+    if (!simd) {
+        return;
+    }
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        tlb->find = find_avx2;
+        tlb->kernel = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        tlb->find = find_sse2;
+        tlb->kernel = "sse2";
+    }
+#endif
+}
+
+/*
+* Allocate an empty TLB
+* sets must be a power of two
+* simd = 0 forces the scalar tag search
+* returns 0 on success, -1 on a bad geometry or out of memory
+*/
+int tlb_init(tlb_t* tlb, uint32_t sets, uint32_t ways, int simd)
+{
+    memset(tlb, 0, sizeof(*tlb));
+    if (sets == 0 || ways == 0 || (sets & (sets - 1)) != 0) {
+        return -1;
+    }
+    uint32_t stride = (ways + TLB_SIMD_MIN - 1) / TLB_SIMD_MIN * TLB_SIMD_MIN;
+    size_t n = (size_t)sets * stride;
+    tlb->sets = sets;
+    tlb->ways = ways;
+    tlb->stride = stride;
+    tlb->set_mask = sets - 1;
+    // 32 byte aligned for the vector loads
+    tlb->tag = aligned_alloc(32, (n * sizeof(uint64_t) + 31) & ~(size_t)31);
+    tlb->ppn = malloc(n * sizeof(ppn_t));
+    tlb->dirty = malloc(n);
+    tlb->prev = malloc(n * sizeof(uint32_t));
+    tlb->next = malloc(n * sizeof(uint32_t));
+    tlb->mru = malloc(sets * sizeof(uint32_t));
+    tlb->lru = malloc(sets * sizeof(uint32_t));
+    tlb->free = malloc(sets * sizeof(uint32_t));
+    if (!tlb->tag || !tlb->ppn || !tlb->dirty || !tlb->prev || !tlb->next ||
+        !tlb->mru || !tlb->lru || !tlb->free) {
+        tlb_free(tlb);
+        return -1;
+    }
+    memset(tlb->tag, 0, n * sizeof(uint64_t));
+    memset(tlb->ppn, 0, n * sizeof(ppn_t));
+    memset(tlb->dirty, 0, n);
+    // every entry starts invalid -> on its set's free stack
+    for (uint32_t s = 0; s < sets; s++) {
+        uint32_t base = s * stride;
+        tlb->mru[s] = TLB_NIL;
+        tlb->lru[s] = TLB_NIL;
+        tlb->free[s] = base;
+        for (uint32_t w = 0; w < ways; w++) {
+            tlb->next[base + w] = (w + 1 < ways) ? base + w + 1 : TLB_NIL;
+        }
+    }
+    pick_kernel(tlb, simd);
+    return 0;
+}
+
+void tlb_free(tlb_t* tlb)
+{
+    free(tlb->tag);
+    free(tlb->ppn);
+    free(tlb->dirty);
+    free(tlb->prev);
+    free(tlb->next);
+    free(tlb->mru);
+    free(tlb->lru);
+    free(tlb->free);
+    memset(tlb, 0, sizeof(*tlb));
+}
+
+/*
+* Save or restore the entries and recency stacks of a TLB that
+* tlb_init() gave the checkpoint's shape
+*/
+void tlb_checkpoint(ckpt_t* c, tlb_t* tlb)
+{
+    size_t n = (size_t)tlb->sets * tlb->stride;
+    ckpt_bytes(c, tlb->tag, n * sizeof(uint64_t));
+    ckpt_bytes(c, tlb->ppn, n * sizeof(ppn_t));
+    ckpt_bytes(c, tlb->dirty, n);
+    ckpt_bytes(c, tlb->prev, n * sizeof(uint32_t));
+    ckpt_bytes(c, tlb->next, n * sizeof(uint32_t));
+    ckpt_bytes(c, tlb->mru, tlb->sets * sizeof(uint32_t));
+    ckpt_bytes(c, tlb->lru, tlb->sets * sizeof(uint32_t));
+    ckpt_bytes(c, tlb->free, tlb->sets * sizeof(uint32_t));
+}
+
+// ---------------------------------------------------------
+//                  Recency stack helpers
+// ---------------------------------------------------------
+static void unlink_entry(tlb_t* tlb, uint32_t set, uint32_t e)
+{
+    uint32_t p = tlb->prev[e], n = tlb->next[e];
+    if (p == TLB_NIL) tlb->mru[set] = n; else tlb->next[p] = n;
+    if (n == TLB_NIL) tlb->lru[set] = p; else tlb->prev[n] = p;
+}
+
+static void push_mru(tlb_t* tlb, uint32_t set, uint32_t e)
+{
+    uint32_t head = tlb->mru[set];
+    tlb->prev[e] = TLB_NIL;
+    tlb->next[e] = head;
+    if (head == TLB_NIL) tlb->lru[set] = e; else tlb->prev[head] = e;
+    tlb->mru[set] = e;
+}
+
+/*
+* Mark a valid entry most recently used
+*/
+void tlb_touch(tlb_t* tlb, uint32_t e)
+{
+    uint32_t set = e / tlb->stride;
+    if (tlb->mru[set] == e) {
+        return;
+    }
+    unlink_entry(tlb, set, e);
+    push_mru(tlb, set, e);
+}
+
+/*
+* Install vpn -> ppn as the most recently used entry of its set
+* Takes an invalid entry if the set has one, otherwise the LRU entry.
+* If a valid entry is kicked out it is copied to evicted,
+* otherwise evicted->valid is 0.
+* returns the new entry index
+*/
+uint32_t tlb_insert(tlb_t* tlb, vpn_t vpn, ppn_t ppn, uint8_t dirty, TLB_entry* evicted)
+{
+    uint32_t set = vpn & tlb->set_mask;
+    uint32_t e = tlb->free[set];
+    if (e != TLB_NIL) {
+        tlb->free[set] = tlb->next[e];
+        evicted->valid = 0;
+    } else {
+        // LRU REPLACEMENT POLICY
+        e = tlb->lru[set];
+        evicted->valid = 1;
+        evicted->vpn = tlb->tag[e] >> 1;
+        evicted->ppn = tlb->ppn[e];
+        evicted->dirty = tlb->dirty[e];
+        unlink_entry(tlb, set, e);
+    }
+    tlb->tag[e] = TLB_TAG(vpn);
+    tlb->ppn[e] = ppn;
+    tlb->dirty[e] = dirty;
+    push_mru(tlb, set, e);
+    return e;
+}
+
+/*
+* Invalidate every entry
+* The valid entries are copied to evicted, which has room for
+* sets * ways entries.
+* returns the number of valid entries
+*/
+uint32_t tlb_flush(tlb_t* tlb, TLB_entry* evicted)
+{
+    uint32_t count = 0;
+    for (uint32_t s = 0; s < tlb->sets; s++) {
+        uint32_t base = s * tlb->stride;
+        for (uint32_t w = 0; w < tlb->ways; w++) {
+            uint32_t e = base + w;
+            if (tlb->tag[e]) {
+                evicted[count].valid = 1;
+                evicted[count].vpn = tlb->tag[e] >> 1;
+                evicted[count].ppn = tlb->ppn[e];
+                evicted[count].dirty = tlb->dirty[e];
+                count++;
+                tlb->tag[e] = 0;
+            }
+            tlb->next[e] = (w + 1 < tlb->ways) ? e + 1 : TLB_NIL;
+        }
+        tlb->mru[s] = TLB_NIL;
+        tlb->lru[s] = TLB_NIL;
+        tlb->free[s] = base;
+    }
+    return count;
+}
+
+/*
+* Drop the mapping for vpn, if the TLB has one
+*/
+void tlb_invalidate(tlb_t* tlb, vpn_t vpn)
+{
+    uint32_t e = tlb_lookup(tlb, vpn);
+    if (e == TLB_NIL) {
+        return;
+    }
+    uint32_t set = e / tlb->stride;
+    tlb->tag[e] = 0;
+    unlink_entry(tlb, set, e);
+    tlb->next[e] = tlb->free[set];
+    tlb->free[set] = e;
+}
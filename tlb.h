@@ -0,0 +1,82 @@
+#ifndef __TLB_H
+#define __TLB_H
+
+#include "vmsim.h"
+#include "checkpoint.h"
+
+#define TLB_NIL UINT32_MAX
+#define TLB_TAG(vpn) ((uint64_t)(vpn) << 1 | 1) // 0 -> invalid entry
+#define TLB_SIMD_MIN 8  // sets narrower than this are searched inline
+
+// Transition Lookaside Buffer entry (unpacked copy of one TLB slot)
+// The TLB never looks inside a VPN, so callers tag theirs with an
+// ASID above VPN_BITS and entries of different processes coexist.
+typedef struct TLB_entry {
+    ppn_t ppn;
+    uint8_t dirty;
+    uint8_t valid;
+    vpn_t vpn;          // ASID << VPN_BITS | VPN
+} TLB_entry;
+
+// tag search kernel: index of key in tags[0..n), TLB_NIL if absent
+// n is a multiple of TLB_SIMD_MIN and tags is 32 byte aligned
+typedef uint32_t (*tlb_find_fn)(const uint64_t* tags, uint32_t n, uint64_t key);
+
+// ---------------------------------------------------------
+// Set associative TLB, sets * ways entries
+// Set s holds entries s * stride .. s * stride + ways - 1 and is
+// picked by the low VPN bits. sets == 1 is fully associative.
+// Entries are stored as parallel arrays so a set's tags are one
+// contiguous run that a SIMD kernel compares 4 or 8 at a time; stride
+// pads each set to a whole number of vectors with zero tags.
+// LRU is a recency stack per set: the valid entries of a set are
+// doubly linked from mru to lru, invalid ones sit on a free stack.
+// Hits, fills and evictions are all O(1) list operations.
+// ---------------------------------------------------------
+typedef struct tlb_t {
+    uint32_t sets;
+    uint32_t ways;
+    uint32_t stride;    // entries per set incl. padding
+    uint32_t set_mask;
+    uint64_t* tag;      // per entry: TLB_TAG(vpn), 0 if invalid
+    ppn_t* ppn;
+    uint8_t* dirty;
+    uint32_t* prev;     // per entry, towards mru
+    uint32_t* next;     // per entry, towards lru (or next free)
+    uint32_t* mru;      // per set
+    uint32_t* lru;      // per set
+    uint32_t* free;     // per set, invalid entries
+    tlb_find_fn find;   // kernel for sets of TLB_SIMD_MIN ways or more
+    const char* kernel; // name of find, for reports
+} tlb_t;
+
+int tlb_init(tlb_t* tlb, uint32_t sets, uint32_t ways, int simd);
+void tlb_free(tlb_t* tlb);
+void tlb_touch(tlb_t* tlb, uint32_t e);
+uint32_t tlb_insert(tlb_t* tlb, vpn_t vpn, ppn_t ppn, uint8_t dirty, TLB_entry* evicted);
+void tlb_invalidate(tlb_t* tlb, vpn_t vpn);
+uint32_t tlb_flush(tlb_t* tlb, TLB_entry* evicted);
+void tlb_checkpoint(ckpt_t* c, tlb_t* tlb);
+
+/*
+* Look up vpn in its set
+* returns the entry index, TLB_NIL on a miss
+*/
+static inline uint32_t tlb_lookup(const tlb_t* tlb, vpn_t vpn)
+{
+    uint64_t key = TLB_TAG(vpn);
+    const uint64_t* tag = tlb->tag + (vpn & tlb->set_mask) * tlb->stride;
+    uint32_t w;
+    if (tlb->ways < TLB_SIMD_MIN) {
+        for (w = 0; w < tlb->ways; w++) {
+            if (tag[w] == key) {
+                return (tag - tlb->tag) + w;
+            }
+        }
+        return TLB_NIL;
+    }
+    w = tlb->find(tag, tlb->stride, key);
+    return w == TLB_NIL ? TLB_NIL : (uint32_t)(tag - tlb->tag) + w;
+}
+
+#endif
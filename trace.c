@@ -0,0 +1,460 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+/*
+* Map a binary trace read-only.
+* returns 1 and fills in map if filename is a binary trace,
+* 0 if it is not one (e.g. a text trace), -1 if it is a corrupt one
+*/
+int trace_map(const char* filename, trace_map_t* map)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(trace_header_t)) {
+        close(fd);
+        return 0;
+    }
+    void* base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  // the mapping keeps the file alive
+    if (base == MAP_FAILED) {
+        return 0;
+    }
+    const trace_header_t* header = (const trace_header_t*) base;
+    if (memcmp(header->magic, TRACE_MAGIC, TRACE_MAGIC_LEN) != 0) {
+        munmap(base, st.st_size);
+        return 0;
+    }
+    // truncated file -> don't read past the end of the mapping
+    size_t room = (st.st_size - sizeof(trace_header_t)) / sizeof(record_t);
+    if (header->count > room) {
+        munmap(base, st.st_size);
+        return -1;
+    }
+    // replay is one front-to-back pass, start reading it in now
+    // (advice values aren't flags, one call each)
+    madvise(base, st.st_size, MADV_SEQUENTIAL);
+    madvise(base, st.st_size, MADV_WILLNEED);
+    map->base = base;
+    map->length = st.st_size;
+    map->records = (const record_t*) (header + 1);
+    map->count = header->count;
+    return 1;
+}
+
+void trace_unmap(trace_map_t* map)
+{
+    if (map->base) {
+        munmap(map->base, map->length);
+    }
+    memset(map, 0, sizeof(*map));
+}
+
+/*
+* Parse a whole text trace into memory, for runs that replay it
+* more than once or need to look ahead
+* returns a malloc()ed array of *count records, NULL on an error
+*/
+record_t* trace_load(FILE* text, size_t* count)
+{
+    size_t n = 0, cap = 1 << 16;
+    record_t* recs = malloc(cap * sizeof(record_t));
+    trace_stream_t* stream = trace_stream_open(text);
+    if (!recs || !stream) {
+        free(recs);
+        return NULL;
+    }
+    const trace_batch_t* batch;
+    while ((batch = trace_stream_next(stream))) {
+        if (recs && n + batch->count > cap) {
+            while (n + batch->count > cap) {
+                cap *= 2;
+            }
+            record_t* bigger = realloc(recs, cap * sizeof(record_t));
+            if (!bigger) {
+                free(recs);
+            }
+            recs = bigger;
+        }
+        // keep draining on failure so the reader thread can finish
+        if (recs) {
+            memcpy(recs + n, batch->records, batch->count * sizeof(record_t));
+            n += batch->count;
+        }
+        trace_stream_release(stream);
+    }
+    if (trace_stream_close(stream) && recs) {
+        free(recs);
+        recs = NULL;
+    }
+    *count = n;
+    return recs;
+}
+
+/*
+* Number the pages of a trace densely, in order of first access
+* Page ids stand in for VPNs in per-page arrays, which for wide
+* address spaces would be far too big indexed by VPN.
+* returns a malloc()ed array of n ids and the number of distinct
+* pages in *pages, NULL out of memory
+*/
+uint32_t* trace_page_ids(const record_t* recs, size_t n, uint page_shift, addr_t va_mask,
+                         size_t* pages)
+{
+    // open addressing, VPN + 1 as the key so 0 is an empty slot
+    size_t cap = 16;
+    while (cap < 2 * n) {
+        cap *= 2;
+    }
+    uint64_t* keys = calloc(cap, sizeof(uint64_t));
+    uint32_t* vals = malloc(cap * sizeof(uint32_t));
+    uint32_t* ids = malloc((n ? n : 1) * sizeof(uint32_t));
+    if (!keys || !vals || !ids) {
+        free(keys);
+        free(vals);
+        free(ids);
+        return NULL;
+    }
+    size_t distinct = 0;
+    for (size_t i = 0; i < n; i++) {
+        // the same VPN in two processes is two pages
+        uint64_t key = ((uint64_t)recs[i].pid << VPN_BITS | (recs[i].pa & va_mask) >> page_shift) + 1;
+        size_t h = (key * 0x9E3779B97F4A7C15ULL) >> 20 & (cap - 1);
+        while (keys[h] && keys[h] != key) {
+            h = (h + 1) & (cap - 1);
+        }
+        if (!keys[h]) {
+            keys[h] = key;
+            vals[h] = distinct++;
+        }
+        ids[i] = vals[h];
+    }
+    free(keys);
+    free(vals);
+    *pages = distinct;
+    return ids;
+}
+
+/*
+* Convert a text trace ("op va pa size [pid [cpu]]" per line) to the binary format
+* returns the number of records written, -1 on a write error
+*/
+long trace_convert(FILE* text, FILE* binary)
+{
+    trace_header_t header;
+    memcpy(header.magic, TRACE_MAGIC, TRACE_MAGIC_LEN);
+    header.count = 0;
+    // header is rewritten with the real count at the end
+    if (fwrite(&header, sizeof(header), 1, binary) != 1) {
+        return -1;
+    }
+    char* line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &cap, text)) >= 0) {
+        record_t rec;
+        if (len && line[len - 1] == '\n') {
+            len--;
+        }
+        if (!trace_parse_line(line, line + len, &rec)) {
+            continue;
+        }
+        if (fwrite(&rec, sizeof(rec), 1, binary) != 1) {
+            free(line);
+            return -1;
+        }
+        header.count++;
+    }
+    free(line);
+    if (fseek(binary, 0, SEEK_SET) != 0 ||
+        fwrite(&header, sizeof(header), 1, binary) != 1) {
+        return -1;
+    }
+    return header.count;
+}
+
+/*
+* Write records as a text trace, the pid only if it or the cpu isn't 0,
+* the cpu only if it isn't 0
+* returns 0 on success, -1 on a write error
+*/
+int trace_write_text(FILE* out, const record_t* recs, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        const record_t* r = &recs[i];
+        int len = r->cpu ? fprintf(out, "%c %06llx %06llx %u %u %u\n", r->op, (unsigned long long)r->va,
+                                   (unsigned long long)r->pa, r->size, r->pid, r->cpu)
+                : r->pid ? fprintf(out, "%c %06llx %06llx %u %u\n", r->op, (unsigned long long)r->va,
+                                   (unsigned long long)r->pa, r->size, r->pid)
+                         : fprintf(out, "%c %06llx %06llx %u\n", r->op, (unsigned long long)r->va,
+                                   (unsigned long long)r->pa, r->size);
+        if (len < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+* Write records as a binary trace
+* returns 0 on success, -1 on a write error
+*/
+int trace_write_binary(FILE* out, const record_t* recs, size_t n)
+{
+    trace_header_t header;
+    memcpy(header.magic, TRACE_MAGIC, TRACE_MAGIC_LEN);
+    header.count = n;
+    if (fwrite(&header, sizeof(header), 1, out) != 1 ||
+        fwrite(recs, sizeof(record_t), n, out) != n) {
+        return -1;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------
+//                  Streaming text reader
+// ---------------------------------------------------------
+static const char* skip_blanks(const char* p, const char* end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+        p++;
+    }
+    return p;
+}
+
+/*  ---------------------------------------------------------
+    Parse one hex field (no 0x prefix), same as %llx
+    returns the first character after the digits, NULL if none
+    ---------------------------------------------------------
+*/
+static const char* parse_hex(const char* p, const char* end, uint64_t* out)
+{
+    uint64_t v = 0;
+    const char* start = p;
+    for (; p < end; p++) {
+        unsigned c = (unsigned char) *p;
+        unsigned d = c - '0';
+        if (d > 9) {
+            d = (c | 0x20) - 'a';   // fold to lower case
+            if (d > 5) {
+                break;
+            }
+            d += 10;
+        }
+        v = v << 4 | d;
+    }
+    *out = v;
+    return p == start ? NULL : p;
+}
+
+static const char* parse_dec(const char* p, const char* end, uint64_t* out)
+{
+    uint64_t v = 0;
+    const char* start = p;
+    for (; p < end && (unsigned)(*p - '0') <= 9; p++) {
+        v = v * 10 + (*p - '0');
+    }
+    *out = v;
+    return p == start ? NULL : p;
+}
+
+/*
+* Parse one "op va pa size [pid [cpu]]" line in [p, end), end excludes
+* the newline
+* returns 1 if a record was parsed, 0 for a blank or malformed line
+*/
+int trace_parse_line(const char* p, const char* end, record_t* rec)
+{
+    uint64_t va, pa, sz, pid = 0, cpu = 0;
+    p = skip_blanks(p, end);
+    if (p == end) {
+        return 0;
+    }
+    char op = *p++;
+    p = skip_blanks(p, end);
+    if (!(p = parse_hex(p, end, &va))) return 0;
+    p = skip_blanks(p, end);
+    if (!(p = parse_hex(p, end, &pa))) return 0;
+    p = skip_blanks(p, end);
+    if (!(p = parse_dec(p, end, &sz))) return 0;
+    // optional process id
+    p = skip_blanks(p, end);
+    if (p < end && !(p = parse_dec(p, end, &pid))) return 0;
+    if (pid > UINT16_MAX) return 0;
+    // optional core
+    p = skip_blanks(p, end);
+    if (p < end && !(p = parse_dec(p, end, &cpu))) return 0;
+    if (cpu > UINT8_MAX) return 0;
+    memset(rec, 0, sizeof(*rec));
+    rec->va = va;
+    rec->pa = pa;
+    rec->size = sz;
+    rec->op = op;
+    rec->pid = pid;
+    rec->cpu = cpu;
+    return 1;
+}
+
+/*
+* Wait for a free slot in the ring
+* returns the batch to fill, already emptied
+*/
+static trace_batch_t* claim_slot(trace_stream_t* stream)
+{
+    pthread_mutex_lock(&stream->lock);
+    while (stream->tail - stream->head == STREAM_SLOTS) {
+        pthread_cond_wait(&stream->drained, &stream->lock);
+    }
+    trace_batch_t* batch = &stream->slots[stream->tail % STREAM_SLOTS];
+    pthread_mutex_unlock(&stream->lock);
+    batch->count = 0;
+    return batch;
+}
+
+static void publish_slot(trace_stream_t* stream, int done)
+{
+    pthread_mutex_lock(&stream->lock);
+    stream->tail++;
+    stream->done = done;
+    pthread_cond_signal(&stream->filled);
+    pthread_mutex_unlock(&stream->lock);
+}
+
+static void* stream_reader(void* arg)
+{
+    trace_stream_t* stream = (trace_stream_t*) arg;
+    // room for one chunk plus the partial line carried over from the last
+    char* buf = malloc(2 * STREAM_CHUNK);
+    size_t carry = 0;
+    int eof = 0;
+    trace_batch_t* batch = claim_slot(stream);
+    if (!buf) {
+        // out of memory -> an error, the empty last batch ends the stream
+        stream->error = 1;
+        publish_slot(stream, 1);
+        return NULL;
+    }
+
+    while (!eof) {
+        size_t n = fread(buf + carry, 1, STREAM_CHUNK, stream->input);
+        if (n < STREAM_CHUNK) {
+            eof = 1;
+            if (ferror(stream->input)) {
+                stream->error = 1;
+            }
+        }
+        const char* p = buf;
+        const char* end = buf + carry + n;
+        // only parse whole lines, except at EOF where the last line
+        // may not have a newline
+        const char* stop = end;
+        if (!eof) {
+            while (stop > p && stop[-1] != '\n') {
+                stop--;
+            }
+        }
+        while (p < stop) {
+            const char* nl = memchr(p, '\n', stop - p);
+            const char* eol = nl ? nl : stop;
+            if (trace_parse_line(p, eol, &batch->records[batch->count])) {
+                if (++batch->count == STREAM_BATCH) {
+                    publish_slot(stream, 0);
+                    batch = claim_slot(stream);
+                }
+            }
+            p = nl ? nl + 1 : stop;
+        }
+        carry = end - stop;
+        if (carry > STREAM_CHUNK) {
+            // no newline in a whole chunk -> not a trace line, drop it
+            carry = 0;
+        }
+        memmove(buf, stop, carry);
+    }
+    // last (possibly empty) batch also carries the end marker
+    publish_slot(stream, 1);
+    free(buf);
+    return NULL;
+}
+
+/*
+* Start a reader thread on input
+* returns NULL if the thread could not be started
+*/
+trace_stream_t* trace_stream_open(FILE* input)
+{
+    trace_stream_t* stream = calloc(1, sizeof(trace_stream_t));
+    if (!stream) {
+        return NULL;
+    }
+    stream->input = input;
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->filled, NULL);
+    pthread_cond_init(&stream->drained, NULL);
+    if (pthread_create(&stream->reader, NULL, stream_reader, stream) != 0) {
+        pthread_mutex_destroy(&stream->lock);
+        pthread_cond_destroy(&stream->filled);
+        pthread_cond_destroy(&stream->drained);
+        free(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+/*
+* Wait for the next parsed batch
+* returns NULL once the trace is exhausted
+* The batch stays valid until trace_stream_release()
+*/
+const trace_batch_t* trace_stream_next(trace_stream_t* stream)
+{
+    pthread_mutex_lock(&stream->lock);
+    while (stream->head == stream->tail && !stream->done) {
+        pthread_cond_wait(&stream->filled, &stream->lock);
+    }
+    if (stream->head == stream->tail) {
+        pthread_mutex_unlock(&stream->lock);
+        return NULL;
+    }
+    // the final batch is published with done set
+    int last = stream->done && stream->head + 1 == stream->tail;
+    trace_batch_t* batch = &stream->slots[stream->head % STREAM_SLOTS];
+    pthread_mutex_unlock(&stream->lock);
+    if (last && batch->count == 0) {
+        return NULL;
+    }
+    return batch;
+}
+
+void trace_stream_release(trace_stream_t* stream)
+{
+    pthread_mutex_lock(&stream->lock);
+    stream->head++;
+    pthread_cond_signal(&stream->drained);
+    pthread_mutex_unlock(&stream->lock);
+}
+
+/*
+* Join the reader thread and free the stream
+* returns nonzero if the input had a read error (or the reader had
+* no memory to read into)
+*/
+int trace_stream_close(trace_stream_t* stream)
+{
+    pthread_join(stream->reader, NULL);
+    int error = stream->error;
+    pthread_mutex_destroy(&stream->lock);
+    pthread_cond_destroy(&stream->filled);
+    pthread_cond_destroy(&stream->drained);
+    free(stream);
+    return error;
+}
@@ -0,0 +1,75 @@
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "vmsim.h"
+
+// ---------------------------------------------------------
+//                  Binary trace format
+// ---------------------------------------------------------
+// header | record_t[count]
+// Records are the in-memory layout of record_t (little endian),
+// so a mapped file is used in place with no parsing.
+// ---------------------------------------------------------
+#define TRACE_MAGIC "VMTRACE1"
+#define TRACE_MAGIC_LEN 8
+
+typedef struct trace_header_t {
+    char magic[TRACE_MAGIC_LEN];
+    uint64_t count;         // number of records after the header
+} trace_header_t;
+
+typedef struct trace_map_t {
+    const record_t* records;
+    size_t count;
+    void* base;             // start of the mapping
+    size_t length;          // length of the mapping
+} trace_map_t;
+
+// ---------------------------------------------------------
+//                  Streaming text reader
+// ---------------------------------------------------------
+// A reader thread parses the text trace into a ring of record
+// batches while the caller simulates the previous ones.
+// ---------------------------------------------------------
+#define STREAM_CHUNK (1 << 20)  // bytes read per fread()
+#define STREAM_BATCH 8192       // records per batch
+#define STREAM_SLOTS 4          // batches in the ring
+
+typedef struct trace_batch_t {
+    record_t records[STREAM_BATCH];
+    size_t count;
+} trace_batch_t;
+
+typedef struct trace_stream_t {
+    FILE* input;
+    pthread_t reader;
+    pthread_mutex_t lock;
+    pthread_cond_t filled;      // reader -> consumer
+    pthread_cond_t drained;     // consumer -> reader
+    trace_batch_t slots[STREAM_SLOTS];
+    size_t head;                // next batch to consume
+    size_t tail;                // next batch to fill
+    int done;                   // reader hit EOF
+    int error;                  // reader hit a read error or ran out of memory
+} trace_stream_t;
+
+trace_stream_t* trace_stream_open(FILE* input);
+const trace_batch_t* trace_stream_next(trace_stream_t* stream);
+void trace_stream_release(trace_stream_t* stream);
+int trace_stream_close(trace_stream_t* stream);
+int trace_parse_line(const char* p, const char* end, record_t* rec);
+
+int trace_map(const char* filename, trace_map_t* map);
+record_t* trace_load(FILE* text, size_t* count);
+uint32_t* trace_page_ids(const record_t* recs, size_t n, uint page_shift, addr_t va_mask,
+                         size_t* pages);
+void trace_unmap(trace_map_t* map);
+long trace_convert(FILE* text, FILE* binary);
+int trace_write_text(FILE* out, const record_t* recs, size_t n);
+int trace_write_binary(FILE* out, const record_t* recs, size_t n);
+
+#endif
@@ -0,0 +1,31 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "trace.h"
+
+// text trace -> binary trace that vmsim can mmap
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage:\n  %s <text trace> <binary trace>\n", argv[0]);
+    return 1;
+  }
+
+  FILE *in = fopen(argv[1], "r");
+  if (!in) {
+    fprintf(stderr, "Trace file %s not found!\n", argv[1]);
+    return 1;
+  }
+  FILE *out = fopen(argv[2], "wb");
+  if (!out) {
+    fprintf(stderr, "Cannot create %s!\n", argv[2]);
+    return 1;
+  }
+
+  long n = trace_convert(in, out);
+  fclose(in);
+  if (fclose(out) != 0 || n < 0) {
+    fprintf(stderr, "Error writing %s!\n", argv[2]);
+    return 1;
+  }
+  return 0;
+}
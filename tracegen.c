@@ -0,0 +1,225 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+// Synthetic traces: one process, va == pa, the size field a random byte
+
+enum { GEN_SEQ, GEN_STRIDE, GEN_UNIFORM, GEN_ZIPF, GEN_PHASE };
+static const char *pattern_names[] = { "seq", "stride", "uniform", "zipf", "phase" };
+
+#define SEQ_STEP 8      // bytes between sequential accesses
+
+typedef struct gen_config_t {
+  int pattern;
+  size_t count;         // records
+  uint64_t footprint;   // bytes touched (per phase)
+  uint64_t page_size;   // zipf picks pages of this size
+  uint64_t stride;
+  double theta;         // zipf exponent
+  uint write_pct;       // writes out of 100 accesses
+  uint phases;
+  uint va_bits;
+  uint cores;           // records pick a cpu at random
+  uint64_t seed;
+} gen_config_t;
+
+// xorshift64*
+static uint64_t rng_state;
+static uint64_t rng() {
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+// a byte count with an optional K, M or G suffix, 0 if it isn't one
+static uint64_t parse_size(const char *s) {
+  char *end;
+  uint64_t v = strtoull(s, &end, 0);
+  switch (*end) {
+    case 'k': case 'K': v <<= 10; end++; break;
+    case 'm': case 'M': v <<= 20; end++; break;
+    case 'g': case 'G': v <<= 30; end++; break;
+  }
+  return end == s || *end ? 0 : v;
+}
+
+// ---------------------------------------------------------
+// Zipf over the pages of the footprint: page rank r is picked with
+// probability ~ 1 / r^theta, ranks are shuffled over the pages
+// ---------------------------------------------------------
+typedef struct zipf_t {
+  double *cdf;
+  uint64_t *page;       // by rank
+  uint64_t pages;
+} zipf_t;
+
+static int zipf_init(zipf_t *z, uint64_t pages, double theta) {
+  z->pages = pages;
+  z->cdf = malloc(pages * sizeof(double));
+  z->page = malloc(pages * sizeof(uint64_t));
+  if (!z->cdf || !z->page) return -1;
+  double sum = 0;
+  for (uint64_t r = 0; r < pages; r++) {
+    sum += 1.0 / pow((double)(r + 1), theta);
+    z->cdf[r] = sum;
+  }
+  for (uint64_t r = 0; r < pages; r++) {
+    z->cdf[r] /= sum;
+    z->page[r] = r;
+  }
+  for (uint64_t r = pages - 1; r > 0; r--) {
+    uint64_t j = rng() % (r + 1);
+    uint64_t t = z->page[r];
+    z->page[r] = z->page[j];
+    z->page[j] = t;
+  }
+  return 0;
+}
+
+static uint64_t zipf_page(const zipf_t *z) {
+  double u = (rng() >> 11) * (1.0 / 9007199254740992.0);
+  uint64_t lo = 0, hi = z->pages - 1;
+  while (lo < hi) {
+    uint64_t mid = (lo + hi) / 2;
+    if (z->cdf[mid] < u) lo = mid + 1;
+    else hi = mid;
+  }
+  return z->page[lo];
+}
+
+// offset into the footprint of access i (i counted from its phase start)
+static uint64_t next_offset(const gen_config_t *cfg, int pattern, size_t i, const zipf_t *z) {
+  switch (pattern) {
+    case GEN_SEQ: return (i * SEQ_STEP) % cfg->footprint;
+    case GEN_STRIDE: return (i * cfg->stride) % cfg->footprint;
+    case GEN_ZIPF: return zipf_page(z) * cfg->page_size + rng() % cfg->page_size;
+    default: return rng() % cfg->footprint;
+  }
+}
+
+/*
+* Generate cfg->count records
+* The phase pattern runs seq, stride, uniform and zipf in turn, each
+* phase over the next footprint's worth of addresses.
+* returns a malloc()ed array, NULL if out of memory
+*/
+static record_t *generate(const gen_config_t *cfg) {
+  record_t *recs = calloc(cfg->count ? cfg->count : 1, sizeof(record_t));
+  zipf_t z = { 0 };
+  if (!recs) return NULL;
+  if ((cfg->pattern == GEN_ZIPF || cfg->pattern == GEN_PHASE) &&
+      zipf_init(&z, cfg->footprint / cfg->page_size, cfg->theta) != 0) {
+    free(recs);
+    return NULL;
+  }
+  uint64_t va_mask = cfg->va_bits >= 64 ? ~0ULL : (1ULL << cfg->va_bits) - 1;
+  size_t phase_len = cfg->pattern == GEN_PHASE ? (cfg->count + cfg->phases - 1) / cfg->phases : cfg->count;
+  for (size_t i = 0; i < cfg->count; i++) {
+    size_t phase = phase_len ? i / phase_len : 0;
+    int pattern = cfg->pattern == GEN_PHASE ? (int)(phase % GEN_PHASE) : cfg->pattern;
+    uint64_t base = cfg->pattern == GEN_PHASE ? phase * cfg->footprint : 0;
+    uint64_t va = (base + next_offset(cfg, pattern, i - phase * phase_len, &z)) & va_mask;
+    recs[i].va = va;
+    recs[i].pa = va;
+    recs[i].size = rng() & 0xFF;
+    recs[i].op = rng() % 100 < cfg->write_pct ? 'w' : 'r';
+    if (cfg->cores > 1) recs[i].cpu = rng() % cfg->cores;
+  }
+  free(z.cdf);
+  free(z.page);
+  return recs;
+}
+
+void usage(const char *prog) {
+  fprintf(stderr, "Usage:\n  %s [-p pattern] [-n records] [-f footprint] [-w percent] [-s stride]\n"
+          "         [-g page] [-z theta] [-P phases] [-v bits] [-c cores] [-S seed]\n"
+          "         <out>\n", prog);
+  fprintf(stderr, "  -p name  seq, stride, uniform (default), zipf, or phase (the\n");
+  fprintf(stderr, "           others in turn, each over a new footprint)\n");
+  fprintf(stderr, "  -n N     records (default 1000000)\n");
+  fprintf(stderr, "  -f N     footprint bytes, K/M/G suffixes (default 4M)\n");
+  fprintf(stderr, "  -w N     percent of accesses that are writes (default 30)\n");
+  fprintf(stderr, "  -s N     stride bytes (default 4K)\n");
+  fprintf(stderr, "  -g N     page size zipf ranks (default 4K)\n");
+  fprintf(stderr, "  -z X     zipf exponent (default 0.99)\n");
+  fprintf(stderr, "  -P N     phases of the phase pattern (default 4)\n");
+  fprintf(stderr, "  -v N     address bits, addresses wrap (default %d)\n", VA_BITS);
+  fprintf(stderr, "  -c N     cores, each record runs on a random one (default 1)\n");
+  fprintf(stderr, "  -S N     random seed (default 1)\n");
+  fprintf(stderr, "  <out>    writes <out>.trace (text) and <out>.bin (binary)\n");
+}
+
+int main(int argc, char **argv) {
+  gen_config_t cfg = { .pattern = GEN_UNIFORM, .count = 1000000, .footprint = 4 << 20,
+                       .page_size = PAGE_SIZE, .stride = PAGE_SIZE, .theta = 0.99,
+                       .write_pct = 30, .phases = 4, .va_bits = VA_BITS, .cores = 1, .seed = 1 };
+  int opt;
+
+  while ((opt = getopt(argc, argv, "p:n:f:w:s:g:z:P:v:c:S:")) != -1) {
+    switch (opt) {
+      case 'p':
+        for (cfg.pattern = 0; cfg.pattern <= GEN_PHASE; cfg.pattern++) {
+          if (strcmp(optarg, pattern_names[cfg.pattern]) == 0) break;
+        }
+        if (cfg.pattern > GEN_PHASE) {
+          fprintf(stderr, "Unknown pattern %s!\n", optarg);
+          return 1;
+        }
+        break;
+      case 'n': cfg.count = strtoull(optarg, NULL, 0); break;
+      case 'f': cfg.footprint = parse_size(optarg); break;
+      case 'w': cfg.write_pct = strtoul(optarg, NULL, 0); break;
+      case 's': cfg.stride = parse_size(optarg); break;
+      case 'g': cfg.page_size = parse_size(optarg); break;
+      case 'z': cfg.theta = atof(optarg); break;
+      case 'P': cfg.phases = strtoul(optarg, NULL, 0); break;
+      case 'v': cfg.va_bits = strtoul(optarg, NULL, 0); break;
+      case 'c': cfg.cores = strtoul(optarg, NULL, 0); break;
+      case 'S': cfg.seed = strtoull(optarg, NULL, 0); break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+  if (optind != argc - 1) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (!cfg.page_size || cfg.footprint < cfg.page_size || !cfg.stride || !cfg.phases ||
+      cfg.write_pct > 100 || !cfg.va_bits || !cfg.cores || cfg.cores > 256) {
+    fprintf(stderr, "Bad footprint, page size, stride, phases, write percent, address bits"
+            " or cores!\n");
+    return 1;
+  }
+  rng_state = cfg.seed ? cfg.seed : 1;
+
+  record_t *recs = generate(&cfg);
+  if (!recs) {
+    fprintf(stderr, "Out of memory for %zu records!\n", cfg.count);
+    return 1;
+  }
+  // <out>.trace and <out>.bin
+  size_t len = strlen(argv[optind]);
+  char *name = malloc(len + 7);
+  if (!name) return 1;
+  const char *ext[] = { ".trace", ".bin" };
+  for (int i = 0; i < 2; i++) {
+    sprintf(name, "%s%s", argv[optind], ext[i]);
+    FILE *out = fopen(name, i ? "wb" : "w");
+    if (!out) {
+      fprintf(stderr, "Cannot create %s!\n", name);
+      return 1;
+    }
+    int err = i ? trace_write_binary(out, recs, cfg.count) : trace_write_text(out, recs, cfg.count);
+    if (fclose(out) != 0 || err) {
+      fprintf(stderr, "Error writing %s!\n", name);
+      return 1;
+    }
+  }
+  free(name);
+  free(recs);
+  return 0;
+}
@@ -1,134 +1,1508 @@
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-#include "vmsim.h"
+#include "context.h"
 #include "assert.h"
 
-counter_t accesses = 0, tlb_hits = 0,
- tlb_misses = 0, page_faults = 0, disk_writes = 0, shutdown_writes = 0;
+// function headers
+vpn_t vpn_translation(vmsim_ctx* vm, addr_t);
+vpn_t vpn_offset(vmsim_ctx* vm, addr_t);
+static void pick_batch_fn(vmsim_ctx* vm);
+static void core_load(vmsim_ctx* vm, uint cpu);
+
+// USEFUL MASKS
+static const int dirty_mask = 0x1; // -> 0001
+static const int valid_mask = 0x2; // -> 0010;
+
+// ---------------------------------------------------------
+
+/*
+* Set a TLB of entries entries, ways way set associative (0 -> fully)
+* returns 0 on success, -1 if entries / ways is not a power of two
+*/
+static int tlb_shape(uint entries, uint ways, uint* sets_out, uint* ways_out)
+{
+    if (!ways) {
+        ways = entries;
+    }
+    if (!entries || entries % ways) {
+        return -1;
+    }
+    uint sets = entries / ways;
+    if (sets & (sets - 1)) {
+        return -1;
+    }
+    *sets_out = sets;
+    *ways_out = ways;
+    return 0;
+}
+
+int vm_config_tlb(vm_config_t* cfg, uint entries, uint ways)
+{
+    return tlb_shape(entries, ways, &cfg->tlb_sets, &cfg->tlb_ways);
+}
+
+/*
+* Same for the second level TLB, 0 entries -> no L2
+*/
+int vm_config_l2_tlb(vm_config_t* cfg, uint entries, uint ways)
+{
+    if (!entries) {
+        cfg->l2_sets = cfg->l2_ways = 0;
+        return 0;
+    }
+    return tlb_shape(entries, ways, &cfg->l2_sets, &cfg->l2_ways);
+}
+
+/*
+* Check that a config can be simulated
+* returns 0 if it can, -1 otherwise
+*/
+int vm_config_check(const vm_config_t* cfg)
+{
+    vm_geometry_t g;
+    return vm_geometry(cfg, &g);
+}
+
+// frames of the page tables made at startup: a flat table or a radix
+// root per process, or the one inverted page table
+static uint64_t pt_startup_frames(const vm_config_t* cfg, const vm_geometry_t* g)
+{
+    return cfg->inverted ? g->pt_frames : (uint64_t)cfg->max_procs * g->pt_frames;
+}
+
+/*
+* Derive the memory geometry and the PTE layout from a config
+* Frame table and page table are placed like the defaults:
+* FT from frame 0, the flat PT (or the radix root) in the frames
+* right after it. The root of a radix table takes the VPN bits
+* left over by the pt_levels - 1 levels below it. An inverted page
+* table has at least as many hash buckets as frames.
+* returns 0 on success, -1 if the geometry is unusable
+*/
+int vm_geometry(const vm_config_t* cfg, vm_geometry_t* g)
+{
+    memset(g, 0, sizeof(*g));
+    if (cfg->page_size < 64 || (cfg->page_size & (cfg->page_size - 1))) {
+        return -1;
+    }
+    g->page_shift = __builtin_ctz(cfg->page_size);
+    g->page_size = cfg->page_size;
+    g->offset_mask = g->page_size - 1;
+    if (cfg->va_bits <= g->page_shift || cfg->va_bits - g->page_shift > VPN_BITS) {
+        return -1;
+    }
+    g->va_bits = cfg->va_bits;
+    g->va_mask = (cfg->va_bits >= 64) ? ~(addr_t)0 : ((addr_t)1 << cfg->va_bits) - 1;
+    g->num_pages = 1ULL << (cfg->va_bits - g->page_shift);
+    if (cfg->mem_size % g->page_size || cfg->mem_size / g->page_size > UINT32_MAX) {
+        return -1;
+    }
+    g->num_frames = cfg->mem_size / g->page_size;
+    // ppn bits + valid + dirty
+    uint ppn_bits = 0;
+    while ((1ULL << ppn_bits) < g->num_frames) {
+        ppn_bits++;
+    }
+    g->pte_bytes = (ppn_bits + PTE_PPN_SHIFT <= 16) ? 2 : (ppn_bits + PTE_PPN_SHIFT <= 32) ? 4 : 8;
+    // page table shape
+    uint vpn_bits = cfg->va_bits - g->page_shift;
+    if (cfg->pt_levels < 1 || cfg->pt_levels > PT_MAX_LEVELS) {
+        return -1;
+    }
+    g->pt_levels = cfg->pt_levels;
+    if (g->pt_levels > 1) {
+        uint64_t fanout = cfg->pt_fanout ? cfg->pt_fanout : g->page_size / g->pte_bytes;
+        // a non-root table is one frame
+        if (fanout < 2 || (fanout & (fanout - 1)) || fanout * g->pte_bytes > g->page_size) {
+            return -1;
+        }
+        g->pt_bits = __builtin_ctzll(fanout);
+        if ((g->pt_levels - 1) * g->pt_bits >= vpn_bits) {
+            return -1;
+        }
+    }
+    g->root_bits = vpn_bits - (g->pt_levels - 1) * g->pt_bits;
+    // the root (or flat) table must fit in memory, an inverted one
+    // doesn't depend on the address space
+    if ((!cfg->inverted && g->root_bits > 40) || (cfg->inverted && g->pt_levels > 1) ||
+        cfg->max_procs < 1 || cfg->max_procs > VM_MAX_PROCS) {
+        return -1;
+    }
+    g->ft_frames = ((uint64_t)g->num_frames * sizeof(FT_entry) + g->page_size - 1) / g->page_size;
+    if (cfg->inverted) {
+        // a bucket per frame or more, then a chain link per frame
+        g->hat_bits = 1;
+        while ((1ULL << g->hat_bits) < g->num_frames) {
+            g->hat_bits++;
+        }
+        g->pt_frames = (((1ULL << g->hat_bits) + g->num_frames) * g->pte_bytes + g->page_size - 1) / g->page_size;
+    } else {
+        g->pt_frames = ((1ULL << g->root_bits) * g->pte_bytes + g->page_size - 1) / g->page_size;
+    }
+    // room for at least one page of data
+    if ((uint64_t)g->ft_frames + pt_startup_frames(cfg, g) >= g->num_frames) {
+        return -1;
+    }
+    // huge pages: at most half of memory, and of the address space
+    if (cfg->huge_size) {
+        if (cfg->huge_size <= g->page_size || (cfg->huge_size & (cfg->huge_size - 1)) ||
+            cfg->huge_size > cfg->mem_size / 2 || cfg->huge_size / g->page_size > g->num_pages / 2) {
+            return -1;
+        }
+        g->huge_order = __builtin_ctzll(cfg->huge_size) - g->page_shift;
+        if (cfg->huge_promote > (1U << g->huge_order)) {
+            return -1;
+        }
+        g->huge_promote = cfg->huge_promote ? cfg->huge_promote :
+                          cfg->num_huge_ranges ? 0 : 1U << g->huge_order;
+    }
+    // prefetching
+    if (cfg->tlb_prefetch < 0 || cfg->tlb_prefetch >= NUM_PREFETCHERS ||
+        (cfg->tlb_prefetch && !cfg->pb_entries) ||
+        (cfg->fault_cluster & (cfg->fault_cluster - 1)) || cfg->fault_cluster > g->num_pages) {
+        return -1;
+    }
+    // a bit per core in the ASID masks
+    if (cfg->cores < 1 || cfg->cores > VM_MAX_CORES) {
+        return -1;
+    }
+    // sampling: a window, and its warm-up, in each period
+    if (cfg->sample_period && (!cfg->sample_window || cfg->sample_warmup > cfg->sample_period ||
+        cfg->sample_window > cfg->sample_period - cfg->sample_warmup)) {
+        return -1;
+    }
+    return 0;
+}
+
+// a number with an optional K, M or G suffix, *s moves past it
+static int parse_number(const char** s, uint64_t* v)
+{
+    char* end;
+    *v = strtoull(*s, &end, 0);
+    if (end == *s) {
+        return -1;
+    }
+    switch (*end) {
+        case 'k': case 'K': *v <<= 10; end++; break;
+        case 'm': case 'M': *v <<= 20; end++; break;
+        case 'g': case 'G': *v <<= 30; end++; break;
+    }
+    *s = end;
+    return 0;
+}
+
+/*
+* Parse a byte count with an optional K, M or G suffix (powers of 2)
+* returns 0 if s is not a number
+*/
+uint64_t vm_parse_size(const char* s)
+{
+    uint64_t v;
+    if (parse_number(&s, &v) != 0 || *s) {
+        return 0;
+    }
+    return v;
+}
+
+/*
+* Parse a comma separated list of start-end address ranges (end
+* exclusive, K/M/G suffixes) into a malloc()ed array
+* returns the number of ranges, -1 on a bad list or out of memory
+*/
+int vm_parse_ranges(const char* s, vm_range_t** ranges)
+{
+    int n = 1;
+    for (const char* c = s; *c; c++) {
+        n += *c == ',';
+    }
+    vm_range_t* r = malloc(n * sizeof(vm_range_t));
+    if (!r) {
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        uint64_t start, end;
+        if (parse_number(&s, &start) != 0 || *s++ != '-' || parse_number(&s, &end) != 0 ||
+            end <= start || *s++ != (i + 1 < n ? ',' : 0)) {
+            free(r);
+            return -1;
+        }
+        r[i].start = start;
+        r[i].end = end;
+    }
+    *ranges = r;
+    return n;
+}
+
+/*
+* Parse a comma separated list of key=cycles latencies (K/M/G
+* suffixes) into lat, keys are the vm_latency_t fields
+* returns 0 on success, -1 on a bad list
+*/
+int vm_parse_latency(const char* s, vm_latency_t* lat)
+{
+    while (*s) {
+        const char* eq = strchr(s, '=');
+        if (!eq) {
+            return -1;
+        }
+        size_t len = eq - s;
+        const char* c = eq + 1;
+        uint64_t v;
+        if (parse_number(&c, &v) != 0 || (*c && *c != ',')) {
+            return -1;
+        }
+        if (len == 2 && strncmp(s, "l1", len) == 0) {
+            lat->l1 = v;
+        } else if (len == 2 && strncmp(s, "l2", len) == 0) {
+            lat->l2 = v;
+        } else if (len == 3 && strncmp(s, "pwc", len) == 0) {
+            lat->pwc = v;
+        } else if (len == 4 && strncmp(s, "walk", len) == 0) {
+            lat->walk = v;
+        } else if (len == 3 && strncmp(s, "mem", len) == 0) {
+            lat->mem = v;
+        } else if (len == 5 && strncmp(s, "fault", len) == 0) {
+            lat->fault = v;
+        } else if (len == 4 && strncmp(s, "disk", len) == 0) {
+            lat->disk = v;
+        } else if (len == 5 && strncmp(s, "queue", len) == 0) {
+            lat->queue = v;
+        } else if (len == 9 && strncmp(s, "shootdown", len) == 0) {
+            lat->shootdown = v;
+        } else if (len == 3 && strncmp(s, "ipi", len) == 0) {
+            lat->ipi = v;
+        } else {
+            return -1;
+        }
+        s = *c ? c + 1 : c;
+    }
+    return 0;
+}
+
+/*
+* Parse period,window[,warmup] accesses of sampled simulation (K/M/G
+* suffixes) into cfg, the warm-up defaults to the window
+* returns 0 on success, -1 on a bad list
+*/
+int vm_parse_sampling(const char* s, vm_config_t* cfg)
+{
+    uint64_t period, window, warmup;
+    if (parse_number(&s, &period) != 0 || *s++ != ',' || parse_number(&s, &window) != 0) {
+        return -1;
+    }
+    warmup = window;
+    if (*s && (*s++ != ',' || parse_number(&s, &warmup) != 0 || *s)) {
+        return -1;
+    }
+    cfg->sample_period = period;
+    cfg->sample_window = window;
+    cfg->sample_warmup = warmup;
+    return 0;
+}
+
+/* 0. Zero out memory (a new anonymous mapping is all zeros)
+*  1. Initialize your TLB (do not place FT or PT in TLB)
+*  2. Create a frame table and place it into mem[].
+*   - The frame table should reside in the first frame of memory
+*   - The frame table should occupy no more than one frame, FTE size is up to you
+*  3. Create a page table and place it into mem[]
+*   - The page table will reside in the sequential frames of memory after the FT
+*   - The page table should not reside in the same frame as the frame table
+*   - Each PTE is limited to 2 bytes maximum
+*  4. Mark all the frames holding the FT and PT as mapped and protected
+*
+* vm_init() is system_init() with the mem[] of a checkpoint mapped at
+* map (map_length bytes, mem[] at mem_offset), map NULL -> a new one.
+*/
+static int vm_init(vmsim_ctx* vm, byte_t* map, size_t map_length, size_t mem_offset)
+{
+    // counters start over so a context can run several simulations
+    memset(&vm->count, 0, sizeof(vm->count));
+    vm->error = NULL;
+    // initstate_r() with 128 bytes is the generator srand() seeds, same sequence
+    memset(&vm->rng, 0, sizeof(vm->rng));
+    initstate_r(vm->config.seed, (char*)vm->rng_state, sizeof(vm->rng_state), &vm->rng);
+    if (vm_geometry(&vm->config, &vm->geo) != 0) {
+        vm_fail(vm, "Bad memory geometry: %llu bytes, %u byte pages, %u bit addresses, "
+                "%u level page table", (counter_t)vm->config.mem_size, vm->config.page_size,
+                vm->config.va_bits, vm->config.pt_levels);
+        return -1;
+    }
+    // ---------------------------------------------------------
+    // reserve zeroed memory (or take a checkpoint's)
+    // the kernel zero fills a host page on its first touch, so
+    // startup doesn't depend on mem_size and the host RSS follows
+    // the frames the simulation uses
+    // ---------------------------------------------------------
+    if (vm->mem_map) {
+        munmap(vm->mem_map, vm->mem_map_length);
+        vm->mem_map = NULL;
+    }
+    if (!map) {
+        map = mmap(NULL, vm->config.mem_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (map == MAP_FAILED) {
+            vm_fail(vm, "Out of memory for %llu bytes of physical memory",
+                    (counter_t)vm->config.mem_size);
+            return -1;
+        }
+        map_length = vm->config.mem_size;
+        mem_offset = 0;
+    }
+    vm->mem_map = map;
+    vm->mem_map_length = map_length;
+    vm->mem = map + mem_offset;
+    // printf("sizeof FTE: %lu\n", sizeof(FT_entry));
+    // ---------------------------------------------------------
+    // initialize the TLB, vm_config.tlb_sets x vm_config.tlb_ways
+    // (fully associative with 5 entries by default), one per core
+    // (do not palce FT or PT in the TLB)
+    // ---------------------------------------------------------
+    if (!vm->cores && !(vm->cores = calloc(vm->config.cores, sizeof(core_t)))) {
+        vm_fail(vm, "Out of memory for %u cores", vm->config.cores);
+        return -1;
+    }
+    vm->prefetcher = &prefetchers[vm->config.tlb_prefetch];
+    for (uint i = 0; i < vm->config.cores; i++) {
+        core_t* core = &vm->cores[i];
+        tlb_free(&core->TLB);
+        if (tlb_init(&core->TLB, vm->config.tlb_sets, vm->config.tlb_ways, vm->config.tlb_simd) != 0) {
+            vm_fail(vm, "Bad TLB geometry %u x %u", vm->config.tlb_sets, vm->config.tlb_ways);
+            return -1;
+        }
+        // optional L2 TLB and (radix tables only) page walk cache
+        tlb_free(&core->STLB);
+        tlb_free(&core->PWC);
+        if (vm->config.l2_sets &&
+            tlb_init(&core->STLB, vm->config.l2_sets, vm->config.l2_ways, vm->config.tlb_simd) != 0) {
+            vm_fail(vm, "Bad L2 TLB geometry %u x %u", vm->config.l2_sets, vm->config.l2_ways);
+            return -1;
+        }
+        if (vm->config.pwc_entries && vm->geo.pt_levels > 1 &&
+            tlb_init(&core->PWC, 1, vm->config.pwc_entries, vm->config.tlb_simd) != 0) {
+            vm_fail(vm, "Bad page walk cache size %u", vm->config.pwc_entries);
+            return -1;
+        }
+        // prefetchers
+        tlb_free(&core->PB);
+        if (vm->config.tlb_prefetch &&
+            tlb_init(&core->PB, 1, vm->config.pb_entries, vm->config.tlb_simd) != 0) {
+            vm_fail(vm, "Bad prefetch buffer size %u", vm->config.pb_entries);
+            return -1;
+        }
+        vm->prefetcher->reset(&core->pf);
+        // every core starts out in pid 0's process
+        core->pid = 0;
+        core->asid = 0;
+        memset(&core->stats, 0, sizeof(core->stats));
+    }
+    vm->TLB = vm->cores[0].TLB;
+    vm->STLB = vm->cores[0].STLB;
+    vm->PWC = vm->cores[0].PWC;
+    vm->PB = vm->cores[0].PB;
+    free(vm->prefetched);
+    vm->prefetched = NULL;
+    if (vm->config.fault_cluster > 1 && !(vm->prefetched = calloc(vm->geo.num_frames, 1))) {
+        vm_fail(vm, "Out of memory for the page fault prefetcher");
+        return -1;
+    }
+    // ---------------------------------------------------------
+    //                  create the Frame Table
+    // ---------------------------------------------------------
+    // main mem is 2^21 bytes / sizeof(page) 2^12 bytes = 2^9 entries = 512 entries
+    // by default, geo.num_frames in general.
+    // 512 * 8 = 4096 -> exactly one page (4096 -> 4KiB)
+    // set frame table to point to first spot in memory array
+    // ---------------------------------------------------------
+    // this is a pointer to the frame that the frame_table occurpies
+    vm->frametable = (FT_entry*) vm->mem;
+    // ---------------------------------------------------------
+    //                  create the Page Table
+    // ---------------------------------------------------------
+    // this will be a pointer to the first frame AFTER the frame table
+    // (the root table of a radix page table, the rest is allocated
+    // a frame at a time by page faults)
+    // every process has one, in ASID order
+    vm->pagetable = vm->mem + (addr_t)vm->geo.ft_frames * vm->geo.page_size;
+    vm->pt_asid = 0;
+    // make sure that all of the entires in the Frame Table and the
+    // Page Table are mapped and protected
+    // page table -> 2^24 / sizeof(page) 2^12 =
+    // 2^12 * 2 bytes = 2 pages by default
+    for(uint32_t i = 0; i < vm->geo.ft_frames + pt_startup_frames(&vm->config, &vm->geo); i++) {
+        vm->frametable[i].protected = 1;
+        vm->frametable[i].mapped = 1;
+    }
+    // ---------------------------------------------------------
+    //                  index the Frame Table
+    // ---------------------------------------------------------
+    // the frames after the startup tables join the indexes when they
+    // are first handed out, until then their part isn't touched
+    vm->frame_words = (vm->geo.num_frames + 63) / 64;
+    free(vm->free_frames);
+    free(vm->evictable);
+    free(vm->evictable_pos);
+    vm->free_frames = calloc(vm->frame_words, sizeof(uint64_t));
+    vm->evictable = malloc(vm->geo.num_frames * sizeof(ppn_t));
+    vm->evictable_pos = malloc(vm->geo.num_frames * sizeof(uint32_t));
+    if (!vm->free_frames || !vm->evictable || !vm->evictable_pos) {
+        vm_fail(vm, "Out of memory for the frame indexes");
+        return -1;
+    }
+    vm->free_hint = 0;
+    vm->num_evictable = 0;
+    vm->frame_hwm = vm->geo.ft_frames + pt_startup_frames(&vm->config, &vm->geo);
+    // ---------------------------------------------------------
+    //                  processes
+    // ---------------------------------------------------------
+    // pid 0 runs until the trace names another one
+    free(vm->proc_stats);
+    free(vm->flushed);
+    free(vm->asid_cores);
+    free(vm->asid_ran);
+    vm->proc_stats = calloc(vm->config.max_procs, sizeof(proc_stats_t));
+    vm->asid_cores = calloc(vm->config.max_procs, sizeof(uint64_t));
+    vm->asid_ran = calloc(vm->config.max_procs, sizeof(uint64_t));
+    // room for L1 and L2 together, or the page walk cache or prefetch buffer
+    size_t flush_max = (size_t)vm->TLB.sets * vm->TLB.ways + (size_t)vm->STLB.sets * vm->STLB.ways;
+    if ((size_t)vm->PWC.sets * vm->PWC.ways > flush_max) {
+        flush_max = (size_t)vm->PWC.sets * vm->PWC.ways;
+    }
+    if ((size_t)vm->PB.sets * vm->PB.ways > flush_max) {
+        flush_max = (size_t)vm->PB.sets * vm->PB.ways;
+    }
+    vm->flushed = malloc(flush_max * sizeof(TLB_entry));
+    if (!vm->proc_stats || !vm->flushed || !vm->asid_cores || !vm->asid_ran) {
+        vm_fail(vm, "Out of memory for the process table");
+        return -1;
+    }
+    // ---------------------------------------------------------
+    //                  writeback queue
+    // ---------------------------------------------------------
+    free(vm->wb_done);
+    vm->wb_done = NULL;
+    vm->wb_head = vm->wb_count = 0;
+    vm->wb_free = 0;
+    if (vm->config.latency.queue &&
+        !(vm->wb_done = malloc(vm->config.latency.queue * sizeof(counter_t)))) {
+        vm_fail(vm, "Out of memory for the writeback queue");
+        return -1;
+    }
+    memset(vm->asid_of_pid, 0, sizeof(vm->asid_of_pid));
+    memset(&vm->slice_start, 0, sizeof(vm->slice_start));
+    vm->asid_of_pid[0] = 1;
+    vm->num_procs = 1;
+    core_load(vm, 0);
+    // ---------------------------------------------------------
+    //                  huge pages
+    // ---------------------------------------------------------
+    huge_table_free(&vm->huge_regions);
+    free(vm->huge_buffer);
+    free(vm->huge_moved);
+    vm->huge_buffer = NULL;
+    vm->huge_moved = NULL;
+    vm->huge_hand = 0;
+    if (vm->geo.huge_order) {
+        vm->huge_buffer = malloc(vm->config.huge_size);
+        vm->huge_moved = malloc(1U << vm->geo.huge_order);
+        if (huge_table_init(&vm->huge_regions) != 0 || !vm->huge_buffer || !vm->huge_moved) {
+            vm_fail(vm, "Out of memory for huge pages");
+            return -1;
+        }
+    }
+    vm->policy = &policies[vm->config.policy];
+    vm->policy->reset(vm);
+    pick_batch_fn(vm);
+    stats_reset(vm);
+    sample_reset(vm);
+    return vm->error ? -1 : 0;
+}
+
+/*
+* returns 0, -1 if out of memory (vmsim_error() has what for)
+*/
+int system_init(vmsim_ctx* vm)
+{
+    return vm_init(vm, NULL, 0, 0);
+}
+
+// ---------------------------------------------------------
+//                      Contexts
+// ---------------------------------------------------------
+#define RUN_RECORDS 4096    // records vmsim_run() asks its source for at once
+
+// a zeroed context of cfg, with its own copy of ranges (the huge page
+// ranges), NULL if out of memory
+static vmsim_ctx* vm_alloc(const vm_config_t* cfg, const vm_range_t* ranges)
+{
+    vmsim_ctx* vm = calloc(1, sizeof(vmsim_ctx));
+    if (!vm) {
+        return NULL;
+    }
+    vm->config = *cfg;
+    if (cfg->num_huge_ranges) {
+        vm->ranges = malloc(cfg->num_huge_ranges * sizeof(vm_range_t));
+        if (!vm->ranges) {
+            free(vm);
+            return NULL;
+        }
+        memcpy(vm->ranges, ranges, cfg->num_huge_ranges * sizeof(vm_range_t));
+    }
+    vm->config.huge_ranges = vm->ranges;
+    return vm;
+}
+
+/*
+* Stop the simulation with an error, unless one stopped it already
+* The record is the next one, callers in the middle of one correct it.
+*/
+void vm_fail(vmsim_ctx* vm, const char* format, ...)
+{
+    if (vm->error) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    vsnprintf(vm->error_msg, sizeof(vm->error_msg), format, args);
+    va_end(args);
+    vm->error = vm->error_msg;
+    vm->error_record = vm->count.accesses + vm->count.ff_accesses;
+}
+
+/*
+* A new simulation of cfg, system_init() done
+* returns NULL if cfg has a bad geometry or out of memory
+*/
+vmsim_ctx* vmsim_create(const vm_config_t* cfg)
+{
+    if (vm_config_check(cfg) != 0) {
+        return NULL;
+    }
+    vmsim_ctx* vm = vm_alloc(cfg, cfg->huge_ranges);
+    if (vm && system_init(vm) != 0) {
+        vmsim_destroy(vm);
+        return NULL;
+    }
+    return vm;
+}
+
+void vmsim_destroy(vmsim_ctx* vm)
+{
+    if (!vm) {
+        return;
+    }
+    if (vm->mem_map) {
+        munmap(vm->mem_map, vm->mem_map_length);
+    }
+    // the running core's TLBs are copies of its entry in cores
+    for (uint i = 0; vm->cores && i < vm->config.cores; i++) {
+        tlb_free(&vm->cores[i].TLB);
+        tlb_free(&vm->cores[i].STLB);
+        tlb_free(&vm->cores[i].PWC);
+        tlb_free(&vm->cores[i].PB);
+    }
+    free(vm->cores);
+    free(vm->asid_cores);
+    free(vm->asid_ran);
+    free(vm->free_frames);
+    free(vm->evictable);
+    free(vm->evictable_pos);
+    free(vm->proc_stats);
+    free(vm->flushed);
+    free(vm->wb_done);
+    huge_table_free(&vm->huge_regions);
+    free(vm->huge_buffer);
+    free(vm->huge_moved);
+    free(vm->prefetched);
+    policy_free(vm);
+    stats_free(vm);
+    free(vm->ranges);
+    free(vm);
+}
+
+/*
+* Simulate the records source gives until it returns 0
+* returns 0, -1 if out of memory for the records or the simulation
+* stopped with an error
+*/
+int vmsim_run(vmsim_ctx* vm, vmsim_source_t source, void* arg)
+{
+    record_t* recs = malloc(RUN_RECORDS * sizeof(record_t));
+    if (!recs) {
+        return -1;
+    }
+    size_t n;
+    int status = 0;
+    while (!status && (n = source(arg, recs, RUN_RECORDS)) > 0) {
+        status = memory_access_batch(vm, recs, n, NULL);
+    }
+    free(recs);
+    return status;
+}
+
+/*
+* Why the simulation stopped
+* returns the message, NULL if it didn't, and in *record (if not NULL)
+* how many records were simulated before the one it stopped at
+*/
+const char* vmsim_error(const vmsim_ctx* vm, uint64_t* record)
+{
+    if (vm->error && record) {
+        *record = vm->error_record;
+    }
+    return vm->error;
+}
+
+const vm_config_t* vmsim_config(const vmsim_ctx* vm)
+{
+    return &vm->config;
+}
+
+const vm_geometry_t* vmsim_geometry(const vmsim_ctx* vm)
+{
+    return &vm->geo;
+}
+
+const vm_counters_t* vmsim_counters(const vmsim_ctx* vm)
+{
+    return &vm->count;
+}
+
+// stats of core, charged when it stops running and by system_shutdown()
+const core_stats_t* vmsim_core_stats(const vmsim_ctx* vm, uint core)
+{
+    return core < vm->config.cores ? &vm->cores[core].stats : NULL;
+}
+
+// page table root of a process (all share an inverted one)
+static byte_t* pt_root(vmsim_ctx* vm, uint32_t asid)
+{
+    if (vm->config.inverted) {
+        asid = 0;
+    }
+    return vm->mem + ((addr_t)vm->geo.ft_frames + (addr_t)asid * vm->geo.pt_frames) * vm->geo.page_size;
+}
+
+// make asid's page table the one pte_get() and pte_set() use
+static void pt_use(vmsim_ctx* vm, uint32_t asid)
+{
+    vm->pagetable = pt_root(vm, asid);
+    vm->pt_asid = asid;
+}
+
+// charge the context's counters since the last switch to the running
+// process and core (a fast-forward's are dropped, see ff_begin())
+static void end_slice(vmsim_ctx* vm)
+{
+    if (vm->fast_forwarding) {
+        return;
+    }
+    proc_stats_t* p = &vm->proc_stats[vm->cur_asid];
+    p->accesses += vm->count.accesses - vm->slice_start.accesses;
+    p->tlb_hits += vm->count.tlb_hits - vm->slice_start.tlb_hits;
+    p->tlb_misses += vm->count.tlb_misses - vm->slice_start.tlb_misses;
+    p->page_faults += vm->count.page_faults - vm->slice_start.page_faults;
+    p->disk_writes += vm->count.disk_writes - vm->slice_start.disk_writes;
+    core_stats_t* c = &vm->cores[vm->cur_core].stats;
+    c->accesses += vm->count.accesses - vm->slice_start.accesses;
+    c->tlb_hits += vm->count.tlb_hits - vm->slice_start.tlb_hits;
+    c->tlb_misses += vm->count.tlb_misses - vm->slice_start.tlb_misses;
+    c->page_faults += vm->count.page_faults - vm->slice_start.page_faults;
+    vm->slice_start.accesses = vm->count.accesses;
+    vm->slice_start.tlb_hits = vm->count.tlb_hits;
+    vm->slice_start.tlb_misses = vm->count.tlb_misses;
+    vm->slice_start.page_faults = vm->count.page_faults;
+    vm->slice_start.disk_writes = vm->count.disk_writes;
+}
+
+static void flush_TLB(vmsim_ctx* vm);
+
+// make cpu the running core
+static void core_load(vmsim_ctx* vm, uint cpu)
+{
+    core_t* core = &vm->cores[cpu];
+    vm->cur_core = cpu;
+    vm->TLB = core->TLB;
+    vm->STLB = core->STLB;
+    vm->PWC = core->PWC;
+    vm->PB = core->PB;
+    vm->pf = &core->pf;
+    vm->cur_pid = core->pid;
+    vm->cur_asid = core->asid;
+    vm->asid_key = (vpn_t)vm->cur_asid << VPN_BITS;
+    pt_use(vm, vm->cur_asid);
+    vm->asid_cores[vm->cur_asid] |= 1ULL << cpu;
+    vm->asid_ran[vm->cur_asid] |= 1ULL << cpu;
+}
+
+/*
+* Run the next accesses on core cpu, in the process it ran last
+* Each core has its own TLBs, everything else is shared.
+* returns 0, -1 if the config has no core cpu
+*/
+int vm_core(vmsim_ctx* vm, uint cpu)
+{
+    if (cpu == vm->cur_core) {
+        return 0;
+    }
+    if (cpu >= vm->config.cores) {
+        vm_fail(vm, "More than %u cores in the trace", vm->config.cores);
+        return -1;
+    }
+    end_slice(vm);
+    vm->cores[vm->cur_core].pid = vm->cur_pid;
+    vm->cores[vm->cur_core].asid = vm->cur_asid;
+    core_load(vm, cpu);
+    return 0;
+}
+
+/*
+* Context switch the running core to process pid
+* A pid seen for the first time gets the next ASID (and page table);
+* the first pid of a trace takes over pid 0's if it hasn't run yet,
+* and a core's first process is no context switch.
+* With vm_config.tlb_flush the core's TLB is flushed, otherwise its
+* entries stay, tagged with their ASID.
+* returns 0, -1 if pid is one process more than vm_config.max_procs
+*/
+int vm_switch(vmsim_ctx* vm, uint pid)
+{
+    if (pid == vm->cur_pid) {
+        return 0;
+    }
+    if (vm->count.accesses + vm->count.ff_accesses == 0) {
+        // nothing ran -> just relabel the first process, on every core
+        vm->asid_of_pid[vm->cur_pid] = 0;
+        vm->asid_of_pid[pid] = vm->cur_asid + 1;
+        vm->proc_stats[vm->cur_asid].pid = pid;
+        vm->cur_pid = pid;
+        for (uint i = 0; i < vm->config.cores; i++) {
+            vm->cores[i].pid = pid;
+        }
+        return 0;
+    }
+    uint32_t asid = vm->asid_of_pid[pid];
+    if (!asid) {
+        if (vm->num_procs == vm->config.max_procs) {
+            vm_fail(vm, "More than %u processes in the trace", vm->config.max_procs);
+            return -1;
+        }
+        asid = ++vm->num_procs;
+        vm->asid_of_pid[pid] = asid;
+        vm->proc_stats[asid - 1].pid = pid;
+    }
+    end_slice(vm);
+    if (vm->cores[vm->cur_core].stats.accesses) {
+        vm->count.context_switches++;
+    }
+    if (vm->config.tlb_flush) {
+        flush_TLB(vm);
+        vm->asid_cores[vm->cur_asid] &= ~(1ULL << vm->cur_core);
+    }
+    vm->cur_pid = pid;
+    vm->cur_asid = asid - 1;
+    vm->asid_key = (vpn_t)vm->cur_asid << VPN_BITS;
+    pt_use(vm, vm->cur_asid);
+    vm->asid_cores[vm->cur_asid] |= 1ULL << vm->cur_core;
+    vm->asid_ran[vm->cur_asid] |= 1ULL << vm->cur_core;
+    return 0;
+}
+
+// unmapped, unprotected frames
+uint32_t vm_free_frames(vmsim_ctx* vm)
+{
+    uint32_t n = vm->geo.num_frames - vm->frame_hwm;
+    for (uint32_t w = 0; w < (vm->frame_hwm + 63) / 64; w++) {
+        n += __builtin_popcountll(vm->free_frames[w]);
+    }
+    return n;
+}
+
+// frame f, never handed out before, joins the evictable list
+static void frame_join(vmsim_ctx* vm, ppn_t f)
+{
+    vm->evictable_pos[f] = vm->num_evictable;
+    vm->evictable[vm->num_evictable++] = f;
+}
+
+// index the frames below end that were never handed out as free
+static void frames_touch(vmsim_ctx* vm, ppn_t end)
+{
+    for (; vm->frame_hwm < end; vm->frame_hwm++) {
+        frame_join(vm, vm->frame_hwm);
+        vm->free_frames[vm->frame_hwm / 64] |= 1ULL << (vm->frame_hwm % 64);
+    }
+}
+
+/*  ---------------------------------------------------------
+    Take the lowest numbered unmapped, unprotected frame: a freed
+    one, or else the first one never handed out
+    returns the frame, -1 if every frame is in use
+    ---------------------------------------------------------
+*/
+static int take_free_frame(vmsim_ctx* vm)
+{
+    uint32_t words = (vm->frame_hwm + 63) / 64;
+    for (; vm->free_hint < words; vm->free_hint++) {
+        uint64_t word = vm->free_frames[vm->free_hint];
+        if (word) {
+            int bit = __builtin_ctzll(word);
+            vm->free_frames[vm->free_hint] = word & (word - 1);
+            return vm->free_hint * 64 + bit;
+        }
+    }
+    if (vm->frame_hwm == vm->geo.num_frames) {
+        return -1;
+    }
+    ppn_t f = vm->frame_hwm++;
+    frame_join(vm, f);
+    // the frames from frame_hwm on are free too
+    vm->free_hint = vm->frame_hwm / 64;
+    return f;
+}
+
+// ---------------------------------------------------------
+//                    PTE access
+// ---------------------------------------------------------
+// The PTE width is a run time value; the hot path passes it as a
+// constant (see the batch instantiations) so the switch folds away.
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+
+ALWAYS_INLINE uint64_t pte_read(const byte_t* p, uint bytes)
+{
+    switch (bytes) {
+        case 2: return *(const uint16_t*) p;
+        case 4: return *(const uint32_t*) p;
+        default: return *(const uint64_t*) p;
+    }
+}
+
+ALWAYS_INLINE void pte_write(byte_t* p, uint bytes, uint64_t pte)
+{
+    switch (bytes) {
+        case 2: *(uint16_t*) p = pte; break;
+        case 4: *(uint32_t*) p = pte; break;
+        default: *(uint64_t*) p = pte; break;
+    }
+}
+
+// flat page table
+ALWAYS_INLINE uint64_t pte_load(vmsim_ctx* vm, vpn_t vpn, uint bytes)
+{
+    return pte_read(vm->pagetable + (addr_t)vpn * bytes, bytes);
+}
+
+ALWAYS_INLINE void pte_store(vmsim_ctx* vm, vpn_t vpn, uint bytes, uint64_t pte)
+{
+    pte_write(vm->pagetable + (addr_t)vpn * bytes, bytes, pte);
+}
+
+static ppn_t alloc_table(vmsim_ctx* vm);
+
+// page walk cache key of the level l table entry on vpn's walk:
+// the VPN bits that index levels 0..l, with the ASID and the level
+static vpn_t pwc_key(vmsim_ctx* vm, vpn_t vpn, uint l)
+{
+    vpn_t prefix = vpn >> (vm->geo.pt_levels - 1 - l) * vm->geo.pt_bits;
+    return (vm->asid_key | prefix) << 2 | l;
+}
+
+/*
+* Walk the radix page table from the root to vpn's leaf PTE
+* Missing tables on the way are allocated if alloc is set, otherwise
+* the walk stops there. If count is set every PTE read on the way is
+* a page walk memory reference.
+* returns the leaf PTE, NULL if its table doesn't exist (or there was
+* no frame for it)
+*/
+static byte_t* radix_walk(vmsim_ctx* vm, vpn_t vpn, int alloc, int count)
+{
+    uint bytes = vm->geo.pte_bytes;
+    vpn_t index_mask = ((vpn_t)1 << vm->geo.pt_bits) - 1;
+    uint shift = (vm->geo.pt_levels - 1) * vm->geo.pt_bits;
+    byte_t* table = vm->pagetable;
+    uint level = 1;
+    int cached = count && vm->PWC.sets;
+    if (cached) {
+        // deepest cached interior entry -> skip the levels above it
+        for (uint l = vm->geo.pt_levels - 1; l-- > 0;) {
+            uint32_t e = tlb_lookup(&vm->PWC, pwc_key(vm, vpn, l));
+            if (e != TLB_NIL) {
+                tlb_touch(&vm->PWC, e);
+                table = vm->mem + (addr_t)vm->PWC.ppn[e] * vm->geo.page_size;
+                level = l + 2;
+                shift -= (l + 1) * vm->geo.pt_bits;
+                break;
+            }
+        }
+        if (level > 1) {
+            vm->count.pwc_hits++;
+        } else {
+            vm->count.pwc_misses++;
+        }
+    }
+    // the root index is what's left above the lower levels
+    vpn_t index = (vpn >> shift) & (level > 1 ? index_mask : ~(vpn_t)0);
+    for (; level < vm->geo.pt_levels; level++) {
+        byte_t* p = table + (addr_t)index * bytes;
+        uint64_t pte = pte_read(p, bytes);
+        if (count) {
+            vm->count.pt_walk_refs++;
+        }
+        if (!(pte & PTE_VALID)) {
+            if (!alloc) {
+                return NULL;
+            }
+            pte = (uint64_t)alloc_table(vm) << PTE_PPN_SHIFT | PTE_VALID;
+            if (vm->error) {
+                return NULL;
+            }
+            pte_write(p, bytes, pte);
+        }
+        if (cached) {
+            // tables are never freed, so cached entries stay right
+            TLB_entry old;
+            tlb_insert(&vm->PWC, pwc_key(vm, vpn, level - 1), pte >> PTE_PPN_SHIFT, 0, &old);
+        }
+        table = vm->mem + (addr_t)(pte >> PTE_PPN_SHIFT) * vm->geo.page_size;
+        shift -= vm->geo.pt_bits;
+        index = (vpn >> shift) & index_mask;
+    }
+    if (count) {
+        vm->count.pt_walk_refs++;
+    }
+    return table + (addr_t)index * bytes;
+}
+
+// ---------------------------------------------------------
+//                  Inverted page table
+// ---------------------------------------------------------
+// With vm_config.inverted all processes share one page table with an
+// entry per frame rather than per page, so its size follows physical
+// memory. A frame's frame table entry (asid, vpn) is its tag. The
+// table holds 1 << geo.hat_bits hash buckets, head << 2 | valid,
+// then a link per frame, next << 2 | valid << 1 | dirty, where valid
+// means the frame's page is in a chain and a chain ends at a frame
+// that links to itself. A page that isn't resident has no entry and
+// reads as 0, so unlike in a flat table its dirty bit doesn't outlive
+// its frame.
+// ---------------------------------------------------------
+// hash bucket of a process's page
+static byte_t* ipt_bucket(vmsim_ctx* vm, uint32_t asid, vpn_t vpn)
+{
+    uint64_t key = (uint64_t)asid << VPN_BITS | vpn;
+    uint64_t b = (key * 0x9E3779B97F4A7C15ULL) >> (64 - vm->geo.hat_bits);
+    return vm->pagetable + b * vm->geo.pte_bytes;
+}
+
+// chain link of a frame
+static byte_t* ipt_link(vmsim_ctx* vm, ppn_t f)
+{
+    return vm->pagetable + ((1ULL << vm->geo.hat_bits) + f) * vm->geo.pte_bytes;
+}
+
+/*
+* Search the chain of asid's page vpn
+* If count is set the bucket and every link probed are page walk
+* memory references (the probes are ipt_probes too).
+* returns the page's frame and in *at the bucket or link that points
+* to it, -1 if the page isn't resident
+*/
+static int64_t ipt_find(vmsim_ctx* vm, uint32_t asid, vpn_t vpn, int count, byte_t** at)
+{
+    uint bytes = vm->geo.pte_bytes;
+    *at = ipt_bucket(vm, asid, vpn);
+    uint64_t e = pte_read(*at, bytes);
+    if (count) {
+        vm->count.pt_walk_refs++;
+    }
+    if (!(e & PTE_VALID)) {
+        return -1;
+    }
+    for (ppn_t f = e >> PTE_PPN_SHIFT;;) {
+        if (count) {
+            vm->count.pt_walk_refs++;
+            vm->count.ipt_probes++;
+        }
+        if (vm->frametable[f].asid == asid && vm->frametable[f].vpn == vpn) {
+            return f;
+        }
+        byte_t* link = ipt_link(vm, f);
+        ppn_t next = pte_read(link, bytes) >> PTE_PPN_SHIFT;
+        if (next == f) {
+            return -1;
+        }
+        *at = link;
+        f = next;
+    }
+}
+
+// take frame f, found at at, out of its chain
+static void ipt_remove(vmsim_ctx* vm, byte_t* at, ppn_t f)
+{
+    uint bytes = vm->geo.pte_bytes;
+    byte_t* link = ipt_link(vm, f);
+    ppn_t next = pte_read(link, bytes) >> PTE_PPN_SHIFT;
+    if (at < ipt_link(vm, 0)) {
+        pte_write(at, bytes, next == f ? 0 : (uint64_t)next << PTE_PPN_SHIFT | PTE_VALID);
+    } else {
+        // the frame before it ends the chain if f did
+        ppn_t prev = (at - ipt_link(vm, 0)) / bytes;
+        uint64_t flags = pte_read(at, bytes) & (PTE_VALID | PTE_DIRTY);
+        pte_write(at, bytes, (uint64_t)(next == f ? prev : next) << PTE_PPN_SHIFT | flags);
+    }
+    pte_write(link, bytes, 0);
+}
+
+// put frame f, tagged with asid's page vpn, at the head of its chain
+static void ipt_insert(vmsim_ctx* vm, uint32_t asid, vpn_t vpn, ppn_t f, uint64_t dirty)
+{
+    uint bytes = vm->geo.pte_bytes;
+    byte_t* bucket = ipt_bucket(vm, asid, vpn);
+    uint64_t head = pte_read(bucket, bytes);
+    ppn_t next = (head & PTE_VALID) ? head >> PTE_PPN_SHIFT : f;
+    pte_write(ipt_link(vm, f), bytes, (uint64_t)next << PTE_PPN_SHIFT | PTE_VALID | dirty);
+    pte_write(bucket, bytes, (uint64_t)f << PTE_PPN_SHIFT | PTE_VALID);
+}
+
+// the PTE a flat table would hold for a resident page, 0 otherwise
+static uint64_t ipt_get(vmsim_ctx* vm, vpn_t vpn, int count)
+{
+    byte_t* at;
+    int64_t f = ipt_find(vm, vm->pt_asid, vpn, count, &at);
+    if (f < 0) {
+        return 0;
+    }
+    return (uint64_t)f << PTE_PPN_SHIFT | (pte_read(ipt_link(vm, f), vm->geo.pte_bytes) & (PTE_VALID | PTE_DIRTY));
+}
+
+// a valid PTE links its frame (tagged by the caller) for the page,
+// an invalid one unlinks the page's frame
+static void ipt_set(vmsim_ctx* vm, vpn_t vpn, uint64_t pte)
+{
+    byte_t* at;
+    int64_t f = ipt_find(vm, vm->pt_asid, vpn, 0, &at);
+    ppn_t ppn = pte >> PTE_PPN_SHIFT;
+    if (f >= 0 && (!(pte & PTE_VALID) || (ppn_t)f != ppn)) {
+        ipt_remove(vm, at, f);
+        f = -1;
+    }
+    if (!(pte & PTE_VALID)) {
+        return;
+    }
+    if (f < 0) {
+        ipt_insert(vm, vm->pt_asid, vpn, ppn, pte & PTE_DIRTY);
+    } else {
+        byte_t* link = ipt_link(vm, ppn);
+        pte_write(link, vm->geo.pte_bytes, (pte_read(link, vm->geo.pte_bytes) & ~(uint64_t)PTE_DIRTY) | (pte & PTE_DIRTY));
+    }
+}
+
+// a frame whose page moved elsewhere leaves its chain
+static void ipt_release(vmsim_ctx* vm, ppn_t f)
+{
+    byte_t* at;
+    if (ipt_find(vm, vm->frametable[f].asid, vm->frametable[f].vpn, 0, &at) == f) {
+        ipt_remove(vm, at, f);
+    }
+}
+
+// any page table, pages with no table read as 0 (invalid, clean)
+static uint64_t pte_get(vmsim_ctx* vm, vpn_t vpn)
+{
+    if (vm->config.inverted) {
+        return ipt_get(vm, vpn, 0);
+    }
+    if (vm->geo.pt_levels == 1) {
+        return pte_load(vm, vpn, vm->geo.pte_bytes);
+    }
+    byte_t* p = radix_walk(vm, vpn, 0, 0);
+    return p ? pte_read(p, vm->geo.pte_bytes) : 0;
+}
+
+// any page table, allocating the tables down to vpn's PTE
+static void pte_set(vmsim_ctx* vm, vpn_t vpn, uint64_t pte)
+{
+    if (vm->config.inverted) {
+        ipt_set(vm, vpn, pte);
+    } else if (vm->geo.pt_levels == 1) {
+        pte_store(vm, vpn, vm->geo.pte_bytes, pte);
+    } else {
+        byte_t* p = radix_walk(vm, vpn, 1, 0);
+        if (p) {
+            pte_write(p, vm->geo.pte_bytes, pte);
+        }
+    }
+}
+
+// another process's page table
+static uint64_t pte_get_in(vmsim_ctx* vm, uint32_t asid, vpn_t vpn)
+{
+    uint32_t current = vm->pt_asid;
+    pt_use(vm, asid);
+    uint64_t pte = pte_get(vm, vpn);
+    pt_use(vm, current);
+    return pte;
+}
 
-// function headers
-vpn_t vpn_translation(addr_t);
-vpn_t vpn_offset(addr_t);
+static void pte_set_in(vmsim_ctx* vm, uint32_t asid, vpn_t vpn, uint64_t pte)
+{
+    uint32_t current = vm->pt_asid;
+    pt_use(vm, asid);
+    pte_set(vm, vpn, pte);
+    pt_use(vm, current);
+}
+
+// another core ran asid, so its PTEs may have dirty bits this core's
+// TLB entries don't (one core alone writes back as a single core does)
+ALWAYS_INLINE int asid_shared(const vmsim_ctx* vm, uint32_t asid)
+{
+    return (vm->asid_ran[asid] & ~(1ULL << vm->cur_core)) != 0;
+}
+
+// write a TLB entry kicked out by a fill or a flush back to its PTE
+// (keeping a dirty bit another core's write set)
+static void tlb_writeback(vmsim_ctx* vm, const TLB_entry* old)
+{
+    if (old->vpn & HUGE_KEY) {
+        return;     // huge page: writes set their base PTE's dirty bit right away
+    }
+    uint32_t asid = old->vpn >> VPN_BITS;
+    vpn_t vpn = old->vpn & VPN_MASK;
+    uint64_t dirty = old->dirty;
+    if (asid_shared(vm, asid)) {
+        dirty |= pte_get_in(vm, asid, vpn) & PTE_DIRTY;
+    }
+    pte_set_in(vm, asid, vpn, (uint64_t)old->ppn << PTE_PPN_SHIFT | PTE_VALID | dirty);
+}
 
-//COUNTERS FOR DEBUGGING
-int randCount = 0;
-int regCount = 0;
+// both TLB levels (L2 first, L1 has the newer dirty bits when
+// inclusive) and the page walk cache, as a CR3 load would
+static void flush_TLB(vmsim_ctx* vm)
+{
+    uint32_t n = 0;
+    if (vm->STLB.sets) {
+        n = tlb_flush(&vm->STLB, vm->flushed);
+    }
+    n += tlb_flush(&vm->TLB, vm->flushed + n);
+    for (uint32_t i = 0; i < n; i++) {
+        tlb_writeback(vm, &vm->flushed[i]);
+    }
+    if (vm->PWC.sets) {
+        tlb_flush(&vm->PWC, vm->flushed);
+    }
+    if (vm->PB.sets) {
+        tlb_flush(&vm->PB, vm->flushed);
+    }
+}
 
-byte_t mem[MEM_SIZE]; //static allocation of memory
-// physical address space 2^20
 // ---------------------------------------------------------
-//                      New Globals
+//                  TLB entries of either page size
 // ---------------------------------------------------------
-struct TLB_entry *TLB;
-struct FT_entry *frametable;
-struct PT_entry *pagetable;
-//Page Table Base Register
-int PTBR = 0;
-// USEFUL MASKS
-int dirty_mask = 0x1; // -> 0001
-int valid_mask = 0x2; // -> 0010;
+// A huge page has one entry for its whole region, keyed apart from
+// base pages (see HUGE_KEY) and holding the region's first frame.
+// Lookups try the base page first, as only one of them can be there.
+// ---------------------------------------------------------
+// TLB key of vpn's huge page, asid_bits is ASID << VPN_BITS
+ALWAYS_INLINE vpn_t huge_key(vmsim_ctx* vm, vpn_t asid_bits, vpn_t vpn)
+{
+    return asid_bits | HUGE_KEY | vpn >> vm->geo.huge_order;
+}
+
+// huge page region table key of vpn's region
+ALWAYS_INLINE vpn_t region_key(vmsim_ctx* vm, uint32_t asid, vpn_t vpn)
+{
+    return (vpn_t)asid << VPN_BITS | vpn >> vm->geo.huge_order;
+}
+
+ALWAYS_INLINE int tlb_is_huge(const tlb_t* tlb, uint32_t e)
+{
+    return (tlb->tag[e] >> 1 & HUGE_KEY) != 0;
+}
+
+/*
+* Look up vpn of the running process in L1
+* returns the base or huge page entry, TLB_NIL on a miss
+*/
+ALWAYS_INLINE uint32_t tlb_find(vmsim_ctx* vm, vpn_t vpn)
+{
+    uint32_t j = tlb_lookup(&vm->TLB, vm->asid_key | vpn);
+    if (j == TLB_NIL && vm->geo.huge_order) {
+        j = tlb_lookup(&vm->TLB, huge_key(vm, vm->asid_key, vpn));
+    }
+    return j;
+}
+
+// frame of vpn through its L1 entry j
+ALWAYS_INLINE ppn_t tlb_frame(vmsim_ctx* vm, uint32_t j, vpn_t vpn)
+{
+    ppn_t ppn = vm->TLB.ppn[j];
+    if (tlb_is_huge(&vm->TLB, j)) {
+        ppn += vpn & (((vpn_t)1 << vm->geo.huge_order) - 1);
+    }
+    return ppn;
+}
+
+// vpn of the running process is part of a huge page
+static int huge_mapped(vmsim_ctx* vm, vpn_t vpn)
+{
+    huge_region_t* r = huge_region(&vm->huge_regions, region_key(vm, vm->cur_asid, vpn), 0);
+    return r && r->huge;
+}
 
 // ---------------------------------------------------------
+//                  L2 TLB
+// ---------------------------------------------------------
+// Inclusive: every L1 entry is also in L2. Fills from a page walk
+// go to both, an L1 victim just hands its dirty bit to its L2 copy
+// and an L2 victim takes the L1 copy with it.
+// Exclusive: L2 holds L1's victims. An L2 hit moves the entry up,
+// fills from a page walk go to L1 only.
+// Entries leaving the hierarchy are written back to their PTE like
+// single level TLB victims.
+// ---------------------------------------------------------
+static void stlb_insert(vmsim_ctx* vm, vpn_t key, ppn_t ppn, uint8_t dirty)
+{
+    TLB_entry old;
+    tlb_insert(&vm->STLB, key, ppn, dirty, &old);
+    if (!old.valid) {
+        return;
+    }
+    if (!vm->config.l2_exclusive) {
+        // back-invalidate the L1 copy, its dirty bit is the newer one
+        uint32_t e = tlb_lookup(&vm->TLB, old.vpn);
+        if (e != TLB_NIL) {
+            old.dirty |= vm->TLB.dirty[e];
+            tlb_invalidate(&vm->TLB, old.vpn);
+        }
+    }
+    tlb_writeback(vm, &old);
+}
+
+// an entry kicked out of L1
+static void l1_victim(vmsim_ctx* vm, const TLB_entry* old)
+{
+    if (vm->config.l2_exclusive) {
+        stlb_insert(vm, old->vpn, old->ppn, old->dirty);
+        return;
+    }
+    uint32_t e = tlb_lookup(&vm->STLB, old->vpn);
+    if (e != TLB_NIL) {
+        vm->STLB.dirty[e] |= old->dirty;
+    } else {
+        tlb_writeback(vm, old);
+    }
+}
+
+/*
+* Look up an L1 miss of vpn in L2 and on a hit move it into L1
+* returns the L1 entry, TLB_NIL on an L2 miss
+*/
+static uint32_t stlb_fill(vmsim_ctx* vm, vpn_t vpn)
+{
+    vpn_t key = vm->asid_key | vpn;
+    uint32_t e = tlb_lookup(&vm->STLB, key);
+    if (e == TLB_NIL && vm->geo.huge_order) {
+        key = huge_key(vm, vm->asid_key, vpn);
+        e = tlb_lookup(&vm->STLB, key);
+    }
+    if (e == TLB_NIL) {
+        vm->count.l2_tlb_misses++;
+        return TLB_NIL;
+    }
+    vm->count.l2_tlb_hits++;
+    ppn_t ppn = vm->STLB.ppn[e];
+    uint8_t dirty = vm->STLB.dirty[e];
+    if (vm->config.l2_exclusive) {
+        tlb_invalidate(&vm->STLB, key);
+    } else {
+        tlb_touch(&vm->STLB, e);
+    }
+    TLB_entry old;
+    uint32_t j = tlb_insert(&vm->TLB, key, ppn, dirty, &old);
+    if (old.valid) {
+        l1_victim(vm, &old);
+    }
+    return j;
+}
+
+// page walk fill: L1 victim, and the L2 copy if inclusive
+static void stlb_walk_fill(vmsim_ctx* vm, vpn_t key, ppn_t ppn, uint8_t dirty, const TLB_entry* old)
+{
+    if (old->valid) {
+        l1_victim(vm, old);
+    }
+    if (!vm->config.l2_exclusive) {
+        stlb_insert(vm, key, ppn, dirty);
+    }
+}
+
+// drop a page's translation from every level of every core
+static void tlb_shootdown(vmsim_ctx* vm, vpn_t key)
+{
+    for (uint i = 0; i < vm->config.cores; i++) {
+        core_t* core = &vm->cores[i];
+        tlb_invalidate(&core->TLB, key);
+        if (core->STLB.sets) {
+            tlb_invalidate(&core->STLB, key);
+        }
+        if (core->PB.sets) {
+            tlb_invalidate(&core->PB, key);
+        }
+    }
+}
+
+// dirty bit of a page's translation at any level of any core, 0 if
+// it has none
+static uint8_t tlb_dirty(vmsim_ctx* vm, vpn_t key)
+{
+    uint8_t dirty = 0;
+    for (uint i = 0; i < vm->config.cores; i++) {
+        core_t* core = &vm->cores[i];
+        uint32_t e = tlb_lookup(&core->TLB, key);
+        if (e != TLB_NIL) {
+            dirty |= core->TLB.dirty[e];
+        }
+        if (core->STLB.sets && (e = tlb_lookup(&core->STLB, key)) != TLB_NIL) {
+            dirty |= core->STLB.dirty[e];
+        }
+    }
+    return dirty;
+}
+
+/*
+* Count a remap of one of asid's pages, whose translations
+* tlb_shootdown() dropped: with several cores the running core sends
+* an interrupt to every other core that ran asid since its last flush
+* (not counted while fast-forwarding)
+*/
+static void shootdown_ipis(vmsim_ctx* vm, uint32_t asid)
+{
+    if (vm->config.cores == 1 || vm->fast_forwarding) {
+        return;
+    }
+    uint64_t targets = vm->asid_cores[asid] & ~(1ULL << vm->cur_core);
+    vm->count.shootdowns++;
+    vm->cores[vm->cur_core].stats.shootdowns++;
+    vm->count.shootdown_ipis += __builtin_popcountll(targets);
+    for (; targets; targets &= targets - 1) {
+        vm->cores[__builtin_ctzll(targets)].stats.ipis++;
+    }
+}
 
 // ---------------------------------------------------------
-//                      New Structs
+//                  TLB prefetching
 // ---------------------------------------------------------
-// Transition Lookaside Buffer
-typedef struct TLB_entry {
-    ppn_t ppn;
-    int dirty;
-    int valid;
-    vpn_t vpn;
-    int age_bit; //pointer to "age bit" array -> # of accesses
-} TLB_entry;
-
-// Frame Table Entry
-typedef struct FT_entry { //4 BYTES
-    uint8_t mapped;     // 8 bits -> 1 if the frame is mapped, 0 if otherwise.
-    uint8_t protected;  // 8 bits -> 1 if the frame is protected, 0 if otherwise.
-    vpn_t vpn;          // 16 bit -> 2^9 pages (2bytes)
-} FT_entry;
-
-// Page Table Entry limited to 2 bytes
-typedef struct PT_entry {
-    unsigned short ppn_valid_dirty; // 2 bytes -> 16 bits (2 bytes)
-    // indexes: 10 - 2  (9 bits)    -> ppn
-    // index:   1       (1 bit)     -> valid
-    // index:   0       (1 bit)     -> dirty
-} PT_entry;
+// Every L1 miss trains the prefetcher, which may then ask for base
+// page translations. Those not in any TLB level are walked (a page
+// that isn't resident is dropped, prefetches never fault) into the
+// prefetch buffer, a small fully associative side TLB. An L1 miss
+// that finds its translation there moves it into L1 like an L2 hit.
+// Buffered entries copy their PTE's dirty bit and are never written,
+// so dropping them loses nothing.
 // ---------------------------------------------------------
+static uint32_t pb_fill(vmsim_ctx* vm, vpn_t vpn)
+{
+    vpn_t key = vm->asid_key | vpn;
+    uint32_t e = tlb_lookup(&vm->PB, key);
+    if (e == TLB_NIL) {
+        return TLB_NIL;
+    }
+    vm->count.tlb_prefetch_hits++;
+    ppn_t ppn = vm->PB.ppn[e];
+    uint8_t dirty = vm->PB.dirty[e];
+    tlb_invalidate(&vm->PB, key);
+    TLB_entry old;
+    uint32_t j = tlb_insert(&vm->TLB, key, ppn, dirty, &old);
+    if (vm->STLB.sets) {
+        stlb_walk_fill(vm, key, ppn, dirty, &old);
+    } else if (old.valid) {
+        tlb_writeback(vm, &old);
+    }
+    return j;
+}
 
+static void tlb_prefetch(vmsim_ctx* vm, vpn_t vpn)
+{
+    vpn_t want[PREFETCH_MAX];
+    uint n = vm->prefetcher->miss(vm->pf, vpn, want);
+    for (uint i = 0; i < n; i++) {
+        vpn_t key = vm->asid_key | want[i];
+        if (want[i] >= vm->geo.num_pages || want[i] == vpn ||
+            tlb_lookup(&vm->TLB, key) != TLB_NIL || tlb_lookup(&vm->PB, key) != TLB_NIL ||
+            (vm->STLB.sets && tlb_lookup(&vm->STLB, key) != TLB_NIL) ||
+            (vm->geo.huge_order && huge_mapped(vm, want[i]))) {
+            continue;
+        }
+        vm->count.tlb_prefetch_walks++;
+        uint64_t pte = pte_get(vm, want[i]);
+        if (pte & PTE_VALID) {
+            TLB_entry old;
+            tlb_insert(&vm->PB, key, pte >> PTE_PPN_SHIFT, pte & PTE_DIRTY, &old);
+            vm->count.tlb_prefetches++;
+        }
+    }
+}
 
-/* 0. Zero out memory
-*  1. Initialize your TLB (do not place FT or PT in TLB)
-*  2. Create a frame table and place it into mem[].
-*   - The frame table should reside in the first frame of memory
-*   - The frame table should occupy no more than one frame, FTE size is up to you
-*  3. Create a page table and place it into mem[]
-*   - The page table will reside in the sequential frames of memory after the FT
-*   - The page table should not reside in the same frame as the frame table
-*   - Each PTE is limited to 2 bytes maximum
-*  4. Mark all the frames holding the FT and PT as mapped and protected
-*
+/*
+* An L1 miss of vpn: the prefetch buffer, then L2, then the prefetcher
+* returns the L1 entry vpn moved into, TLB_NIL if it needs a walk
 */
-void system_init()
+static uint32_t tlb_refill(vmsim_ctx* vm, vpn_t vpn)
 {
-    // ---------------------------------------------------------
-    // zero out memory
-    // ---------------------------------------------------------
-    for(int i = 0; i < MEM_SIZE; i++) {
-        mem[i] = 0;
+    uint32_t j = TLB_NIL;
+    if (vm->PB.sets) {
+        j = pb_fill(vm, vpn);
     }
-    // printf("sizeof FTE: %lu\n", sizeof(FT_entry));
-    // ---------------------------------------------------------
-    // initialize the TLB to be fully associative with 5 entries
-    // (do not palce FT or PT in the TLB)
-    // ---------------------------------------------------------
-    TLB = (TLB_entry*)malloc(TLB_SIZE * sizeof(TLB_entry));
-    for(int j = 0; j < TLB_SIZE; j++) {
-        TLB[j].ppn = (uint32_t)malloc(sizeof(uint32_t));
-        TLB[j].dirty = (int)malloc(sizeof(int));
-        TLB[j].valid = (int)malloc(sizeof(int));
-        TLB[j].vpn = (addr_t)malloc(sizeof(addr_t));
-        TLB[j].age_bit = (addr_t)malloc(sizeof(addr_t));
-    }
-    // set all entries to be zero.
-    for(int j = 0; j < TLB_SIZE; j++) {
-        TLB[j].ppn = 0;
-        TLB[j].dirty = 0;
-        TLB[j].valid = 0;
-        TLB[j].vpn = 0;
-        TLB[j].age_bit = 0;
+    if (j == TLB_NIL && vm->STLB.sets) {
+        j = stlb_fill(vm, vpn);
     }
-    // ---------------------------------------------------------
-    //                  create the Frame Table
-    // ---------------------------------------------------------
-    // main mem is 2^21 bytes / sizeof(page) 2^12 bytes = 2^9 entries = 512 entries
-    // this is calculated as a global.
-    // 512 * 4 = 2048 < size of one page (4096 -> 4KiB)
-    // set frame table to point to first spot in memory array
-    // ---------------------------------------------------------
-    // this is a pointer to the frame that the frame_table occurpies
-    frametable = (FT_entry*) mem;
-    // ---------------------------------------------------------
-    //                  create the Page Table
-    // ---------------------------------------------------------
-    // this will be a pointer to the first frame AFTER the frame table
-    pagetable = (PT_entry*) (mem + PAGE_SIZE);
-    // make sure that all of the entires in the Frame Table and the
-    // Page Table are mapped and protected
-    // frame table
-    frametable[0].protected = 1;
-    frametable[0].mapped = 1;
-    // page table -> 2^24 / sizeof(page) 2^12 =
-    // 2^12 * 2 bytes = 2 pages
-    frametable[1].protected = 1;   // page table
-    frametable[1].mapped = 1;      // page table
-    frametable[2].protected = 1;   // page table
-    frametable[2].protected = 1;   // page table
+    if (vm->PB.sets) {
+        tlb_prefetch(vm, vpn);
+    }
+    return j;
+}
+
+// the lookup a TLB miss does, counted in pt_walk_refs
+static uint64_t pte_walk(vmsim_ctx* vm, vpn_t vpn)
+{
+    if (vm->config.inverted) {
+        return ipt_get(vm, vpn, 1);
+    }
+    if (vm->geo.pt_levels == 1) {
+        vm->count.pt_walk_refs++;
+        return pte_load(vm, vpn, vm->geo.pte_bytes);
+    }
+    byte_t* p = radix_walk(vm, vpn, 0, 1);
+    return p ? pte_read(p, vm->geo.pte_bytes) : 0;
+}
+
+/*
+* Count the dirty, valid leaf PTEs of a radix (sub)table
+*/
+static counter_t radix_dirty(vmsim_ctx* vm, const byte_t* table, uint level, uint64_t entries)
+{
+    counter_t dirty = 0;
+    for (uint64_t i = 0; i < entries; i++) {
+        uint64_t pte = pte_read(table + i * vm->geo.pte_bytes, vm->geo.pte_bytes);
+        if (!(pte & PTE_VALID)) {
+            continue;
+        }
+        if (level + 1 == vm->geo.pt_levels) {
+            dirty += pte & PTE_DIRTY;
+        } else {
+            dirty += radix_dirty(vm, vm->mem + (addr_t)(pte >> PTE_PPN_SHIFT) * vm->geo.page_size,
+                                 level + 1, 1ULL << vm->geo.pt_bits);
+        }
+    }
+    return dirty;
 }
 
 /* At system shutdown, you need to write all dirty
@@ -138,20 +1512,48 @@ void system_init()
 * shutdown_writes
 * finally, return mem
 */
-byte_t* system_shutdown()
+byte_t* system_shutdown(vmsim_ctx* vm)
 {
-    // loop through PT entries -> count the amount of dirty bits
-    uint8_t dirty = 0, valid = 0;
-    for (int i = 0; i < PAGE_SIZE; i++) {
-        dirty = pagetable[i].ppn_valid_dirty & dirty_mask;
-        // printf("dirty: %d\n", dirty);
-        valid = (pagetable[i].ppn_valid_dirty & valid_mask) >> 1;
-        // printf("valid: %d\n", valid);
-        if (dirty == 1 & valid == 1) {
-            shutdown_writes++;
+    end_slice(vm);
+    // an inverted page table: the dirty links, by their frame's process
+    if (vm->config.inverted) {
+        for (uint32_t asid = 0; asid < vm->num_procs; asid++) {
+            vm->proc_stats[asid].shutdown_writes = 0;
+        }
+        for (ppn_t f = 0; f < vm->frame_hwm; f++) {
+            uint64_t link = pte_read(ipt_link(vm, f), vm->geo.pte_bytes);
+            if ((link & (PTE_VALID | PTE_DIRTY)) == (PTE_VALID | PTE_DIRTY)) {
+                vm->count.shutdown_writes++;
+                vm->proc_stats[vm->frametable[f].asid].shutdown_writes++;
+            }
+        }
+        return vm->mem;
+    }
+    // every process's page table
+    uint32_t current = vm->pt_asid;
+    for (uint32_t asid = 0; asid < vm->num_procs; asid++) {
+        counter_t before = vm->count.shutdown_writes;
+        pt_use(vm, asid);
+        if (vm->geo.pt_levels > 1) {
+            vm->count.shutdown_writes += radix_dirty(vm, vm->pagetable, 0, 1ULL << vm->geo.root_bits);
+        } else {
+            // loop through PT entries -> count the amount of dirty bits
+            uint8_t dirty = 0, valid = 0;
+            for (uint64_t i = 0; i < vm->geo.num_pages; i++) {
+                uint64_t pte = pte_get(vm, i);
+                dirty = pte & dirty_mask;
+                // printf("dirty: %d\n", dirty);
+                valid = (pte & valid_mask) >> 1;
+                // printf("valid: %d\n", valid);
+                if (dirty == 1 & valid == 1) {
+                    vm->count.shutdown_writes++;
+                }
+            }
         }
+        vm->proc_stats[asid].shutdown_writes = vm->count.shutdown_writes - before;
     }
-  return mem;
+    pt_use(vm, current);
+  return vm->mem;
 }
 
 /*
@@ -161,34 +1563,36 @@ byte_t* system_shutdown()
 * Updates the state of TLB based on write
 *
 */
-status_t check_TLB(addr_t vaddr, uint write, addr_t* paddr)
+status_t check_TLB(vmsim_ctx* vm, addr_t vaddr, uint write, addr_t* paddr)
 {
     // address conversion
-    vpn_t vpn = vpn_translation(vaddr);
-    vpn_t offset = vpn_offset(vaddr);
+    vpn_t vpn = vpn_translation(vm, vaddr);
+    vpn_t offset = vpn_offset(vm, vaddr);
     // offset length
-    int offset_length = log2(PAGE_SIZE);
-    // loop over TLB entries
-    for(int j = 0; j < TLB_SIZE; j++) {
-        if (TLB[j].valid == 1 & TLB[j].vpn == vpn) {
-            // return physical address
-            // shift ppn over the offset_length and concat with the offset bits
-            regCount++;
-            // printf("%d\n", regCount);
-            *paddr = TLB[j].ppn << offset_length | offset;
-            // hit
-            tlb_hits++;
-            // if this is a write -> make the entry dirty
-            if (write) {
-                TLB[j].dirty = 1;
-            }
-            // return HIT
-            return HIT;
+    int offset_length = vm->geo.page_shift;
+    // look up the VPN in its set
+    uint32_t j = tlb_find(vm, vpn);
+    if (j != TLB_NIL) {
+        // hit
+        vm->count.tlb_hits++;
+        vm->count.huge_tlb_hits += tlb_is_huge(&vm->TLB, j);
+    } else {
+        vm->count.tlb_misses++;
+        // an L2 (or prefetch buffer) hit moves the entry into L1 -> a hit for the caller
+        if ((j = tlb_refill(vm, vpn)) == TLB_NIL) {
+            // do not return the pyhsical address
+            return MISS;
         }
     }
-    tlb_misses++;
-    // do not return the pyhsical address
-    return MISS;
+    // return physical address
+    // shift ppn over the offset_length and concat with the offset bits
+    *paddr = (addr_t)tlb_frame(vm, j, vpn) << offset_length | offset;
+    // if this is a write -> make the entry dirty
+    if (write) {
+        vm->TLB.dirty[j] = 1;
+    }
+    // return HIT
+    return HIT;
 }
 
 /*
@@ -197,18 +1601,17 @@ status_t check_TLB(addr_t vaddr, uint write, addr_t* paddr)
 * If HIT, returns the physcial address in paddr
 * Updates the state of Page Table based on write
 */
-status_t check_PT(addr_t vaddr, uint write, addr_t* paddr)
+status_t check_PT(vmsim_ctx* vm, addr_t vaddr, uint write, addr_t* paddr)
 {
     // address conversion
-    vpn_t vpn = vpn_translation(vaddr);
-    vpn_t offset = vpn_offset(vaddr);
+    vpn_t vpn = vpn_translation(vm, vaddr);
+    vpn_t offset = vpn_offset(vm, vaddr);
     // get the valid bit from the page table entry
-    int valid = pagetable[vpn].ppn_valid_dirty & valid_mask;
+    uint64_t pte = pte_walk(vm, vpn);
+    int valid = pte & valid_mask;
     // if not valid -> increment counters
-    // return this?
-    int ppn_mask = 0x7FC; // -> 0000011111111100
     //shfit
-    int offset_length = log2(PAGE_SIZE);
+    int offset_length = vm->geo.page_shift;
     // physical address
     // paddr_t phy_addr;
     // new ppn
@@ -218,161 +1621,467 @@ status_t check_PT(addr_t vaddr, uint write, addr_t* paddr)
         // build the physical address
         // paddr_t phy_addr = (paddr_t) ((pfn << OFFSET_LEN) | offset);
         // printf("HERE");
-        *paddr = (((ppn_mask) & pagetable[vpn].ppn_valid_dirty) << (offset_length - 2)) | offset;
+        *paddr = (addr_t)(pte >> PTE_PPN_SHIFT) << offset_length | offset;
         // return HIT
         return HIT;
     } else {
-        page_faults++;
+        vm->count.page_faults++;
         // get a new page
         if (write) {
             // make dirty
-            pagetable[vpn].ppn_valid_dirty = pagetable[vpn].ppn_valid_dirty | dirty_mask;
+            pte_set(vm, vpn, pte | dirty_mask);
         }
-        ppn = page_fault(vaddr, write);
+        PROF_BEGIN(vm, PROF_PAGE_FAULT);
+        ppn = page_fault(vm, vaddr, write);
+        PROF_END(vm, PROF_PAGE_FAULT);
         // i++;
         // printf("\nvirt add: %lu", vaddr);
         // printf("\npage num: %d", ppn);
-        *paddr = ppn << offset_length | offset;
+        *paddr = (addr_t)ppn << offset_length | offset;
         // printf("address: %lu\n", *paddr);
         // printf("\ni: %d", i);
         return MISS;
     }
 }
-// ---------------------------------------------------------
-//                    Helper Methods
-/*  --------------------make-------------------------------------
-    Extract the virual page number from the virtual address
-    ---------------------------------------------------------
-*/
-vpn_t vpn_translation(addr_t vaddr) {
-    int offset = log2(PAGE_SIZE);
-    return vaddr >> offset;
-}
-/*  ---------------------------------------------------------
-    Extract the offset from the virtual address;
-    same mapping to physical address.
-    ---------------------------------------------------------
+// ---------------------------------------------------------
+//                    Helper Methods
+/*  --------------------make-------------------------------------
+    Extract the virual page number from the virtual address
+    ---------------------------------------------------------
+*/
+vpn_t vpn_translation(vmsim_ctx* vm, addr_t vaddr) {
+    return vaddr >> vm->geo.page_shift;
+}
+/*  ---------------------------------------------------------
+    Extract the offset from the virtual address;
+    same mapping to physical address.
+    ---------------------------------------------------------
+*/
+vpn_t vpn_offset(vmsim_ctx* vm, addr_t vaddr) {
+    return vaddr & vm->geo.offset_mask;
+}
+// ---------------------------------------------------------
+/*
+* Updates the TLB
+* If you hit in the tlb, you still need to update LRU status
+* as well as dirty status:
+*   Remember, if the dirty bit is newly set, you should go to memory and
+*   mark the corresponding PTE dirty
+* If you miss in the TLB, you need to replace:
+*   First, check the TLB for any invalid entries
+*   If one is found, install the vaddr mapping into it
+*   Otherwise, consult an LRU replacement policy
+*
+* When a TLB entry is kicked out, what should you do? Anything?
+*/
+void update_TLB(vmsim_ctx* vm, addr_t vaddr, uint write, addr_t paddr, status_t tlb_access)
+{
+    // address conversion
+    vpn_t vpn = vpn_translation(vm, vaddr);
+    vpn_t offset = vpn_offset(vm, vaddr);
+    int offset_length = vm->geo.page_shift;
+    // new ppn to store on the miss -> whether found invalid or replace:
+    ppn_t ppn = paddr >> offset_length;
+    // TLB ACCESSING
+    if (tlb_access == HIT) { // HIT
+        uint32_t j = tlb_find(vm, vpn);
+        tlb_touch(&vm->TLB, j); // most recently used
+        if (write) {
+            // update TLB
+            vm->TLB.dirty[j] = 1;
+            // mark the corresponding PTE dirty
+            pte_set(vm, vpn, pte_get(vm, vpn) | dirty_mask);
+        }
+    } else { // MISS
+        // a huge page's entry maps its region from the first frame
+        vpn_t key = vm->asid_key | vpn;
+        ppn_t first = ppn;
+        int huge = vm->geo.huge_order && huge_mapped(vm, vpn);
+        if (huge) {
+            key = huge_key(vm, vm->asid_key, vpn);
+            first -= vpn & (((vpn_t)1 << vm->geo.huge_order) - 1);
+        }
+        // takes an invalid entry if there is one, otherwise the LRU one
+        TLB_entry old;
+        tlb_insert(&vm->TLB, key, first, write ? 1 : 0, &old);
+        if (vm->STLB.sets) {
+            // the victim goes to L2, the new entry too if inclusive
+            stlb_walk_fill(vm, key, first, write ? 1 : 0, &old);
+        } else if (old.valid) {
+            // KICK OUT -> write the old entry back to its PTE
+            // (which may be another process's)
+            tlb_writeback(vm, &old);
+        }
+        if (huge) {
+            // never written back -> the PTE gets the dirty bit now
+            if (write) {
+                pte_set(vm, vpn, pte_get(vm, vpn) | dirty_mask);
+            }
+        } else if (!old.valid) {
+            // write through!!
+            pte_set(vm, vpn, (uint64_t)ppn << PTE_PPN_SHIFT | valid_mask | (write ? dirty_mask : 0));
+        }
+    }
+}
+
+// ---------------------------------------------------------
+//                  Timing model
+// ---------------------------------------------------------
+// Every event costs its vm_config.latency and they add up in
+// order, so the clock at any point follows from the counts so far.
+// Prefetch walks, huge page promotions and the pages mapped around a
+// page fault are free. Dirty writebacks either stall the page fault
+// that evicts them or, with a queue, overlap later accesses: the disk
+// does one at a time and a fault waits only for a free queue slot.
+// ---------------------------------------------------------
+void vm_timing(const vmsim_ctx* vm, vm_timing_t* t)
+{
+    const vm_latency_t* lat = &vm->config.latency;
+    t->translation = vm->count.accesses * lat->l1 + (vm->count.l2_tlb_hits + vm->count.l2_tlb_misses) * lat->l2 +
+                     (vm->count.pwc_hits + vm->count.pwc_misses) * lat->pwc + vm->count.pt_walk_refs * lat->walk;
+    t->data = vm->count.accesses * lat->mem;
+    t->faults = vm->count.page_faults * lat->fault;
+    t->writebacks = vm->count.wb_stall_cycles;
+    t->shootdowns = vm->count.shootdowns * lat->shootdown + vm->count.shootdown_ipis * lat->ipi;
+    t->cycles = t->translation + t->data + t->faults + t->writebacks + t->shootdowns;
+    t->amat = vm->count.accesses ? (double)t->cycles / vm->count.accesses : 0.0;
+}
+
+// a dirty page goes to disk
+static void writeback(vmsim_ctx* vm)
+{
+    const vm_latency_t* lat = &vm->config.latency;
+    if (!lat->queue) {
+        vm->count.wb_stall_cycles += lat->disk;
+        return;
+    }
+    vm_timing_t t;
+    vm_timing(vm, &t);
+    counter_t now = t.cycles;
+    // writebacks done by now leave the queue, a full one waits for the oldest
+    while (vm->wb_count && (vm->wb_done[vm->wb_head] <= now || vm->wb_count == lat->queue)) {
+        if (vm->wb_done[vm->wb_head] > now) {
+            vm->count.wb_stall_cycles += vm->wb_done[vm->wb_head] - now;
+            now = vm->wb_done[vm->wb_head];
+        }
+        vm->wb_head = (vm->wb_head + 1) % lat->queue;
+        vm->wb_count--;
+    }
+    vm->wb_free = (vm->wb_free > now ? vm->wb_free : now) + lat->disk;
+    vm->wb_done[(vm->wb_head + vm->wb_count++) % lat->queue] = vm->wb_free;
+}
+
+static void huge_evicted(vmsim_ctx* vm, uint32_t asid, vpn_t vpn);
+
+/*
+* Take the page in a frame out of memory
+* Invalidates its PTE and TLB entry (splitting its huge page first),
+* a dirty page is a disk write.
+* The frame stays mapped in the frame table.
+*/
+static void evict_frame(vmsim_ctx* vm, ppn_t randPage)
+{
+    // save the old VPN (and its process) to set the valid bit to 0
+    vpn_t vpnOld = vm->frametable[randPage].vpn;
+    uint32_t asidOld = vm->frametable[randPage].asid;
+    if (vm->geo.huge_order) {
+        huge_evicted(vm, asidOld, vpnOld);
+    }
+    if (vm->prefetched) {
+        vm->prefetched[randPage] = 0;
+    }
+    // old dirty
+    int dirty = pte_get_in(vm, asidOld, vpnOld) & dirty_mask;
+    // now build the page table entry
+    // mark the old as invalid
+    /// -> 0 0 0 0 0 1 1 1 1 1 1 1 1 1 0 1
+    // -> this makes it invalid
+    pte_set_in(vm, asidOld, vpnOld, (uint64_t)randPage << PTE_PPN_SHIFT | dirty);
+    // is this frame being replaced PTE dirty using the mask.
+    if (dirty) { // if the old is dirty
+        vm->count.disk_writes++;
+        // (fast-forwarded ones take no time, there is no clock then)
+        if (!vm->fast_forwarding) {
+            writeback(vm);
+        }
+    }
+    // *-------------------------------------------------------------
+    // if the new randPage is in the TLB -> make invalid
+    // you do not want this mapping to be used.
+    // *-------------------------------------------------------------
+    // the only TLB entry that can hold randPage is the one for vpnOld
+    tlb_shootdown(vm, (vpn_t)asidOld << VPN_BITS | vpnOld); // make sure that this mapping cannot be used.
+    shootdown_ipis(vm, asidOld);   // (with a huge page split, one shootdown)
+}
+
+/*
+* Free the policy's victim frame for a new page
+* returns the frame, still mapped in the frame table, 0 and the
+* simulation stops if page tables fill every frame
+*/
+static ppn_t evict_victim(vmsim_ctx* vm)
+{
+    if (!vm->num_evictable) {
+        vm_fail(vm, "Out of frames: page tables fill physical memory");
+        return 0;
+    }
+    ppn_t randPage = vm->policy->victim(vm);
+    evict_frame(vm, randPage);
+    return randPage;
+}
+
+// ---------------------------------------------------------
+//                  Huge pages
+// ---------------------------------------------------------
+// A huge page maps an aligned region of 1 << geo.huge_order base
+// pages to an aligned block of as many frames. Base PTEs and frame
+// table entries stay per base page, so walks, dirty bits and the
+// replacement policy see base pages; only the TLB holds one entry
+// for the region. A region is promoted on the page fault that makes
+// geo.huge_promote of its pages resident (any page fault inside
+// vm_config.huge_ranges) and split back into base pages when one of
+// its frames is evicted.
+// ---------------------------------------------------------
+// one of the region's base pages loses its frame
+static void huge_evicted(vmsim_ctx* vm, uint32_t asid, vpn_t vpn)
+{
+    huge_region_t* r = huge_region(&vm->huge_regions, region_key(vm, asid, vpn), 0);
+    if (!r) {
+        return;
+    }
+    r->resident--;
+    if (r->huge) {
+        // its base PTEs already map every page
+        r->huge = 0;
+        vm->count.huge_demotions++;
+        tlb_shootdown(vm, huge_key(vm, (vpn_t)asid << VPN_BITS, vpn));
+    }
+}
+
+// a frame whose page moved elsewhere becomes free
+static void release_frame(vmsim_ctx* vm, ppn_t frame)
+{
+    if (vm->config.inverted) {
+        ipt_release(vm, frame);
+    }
+    vm->frametable[frame].mapped = 0;
+    vm->free_frames[frame / 64] |= 1ULL << (frame % 64);
+    if (frame / 64 < vm->free_hint) {
+        vm->free_hint = frame / 64;
+    }
+    if (vm->prefetched) {
+        vm->prefetched[frame] = 0;
+    }
+    if (vm->policy->unmap) {
+        vm->policy->unmap(vm, frame);
+    }
+}
+
+// vpn's region lies inside one of vm_config.huge_ranges
+static int huge_in_range(vmsim_ctx* vm, vpn_t vpn)
+{
+    uint shift = vm->geo.huge_order + vm->geo.page_shift;
+    addr_t start = (addr_t)(vpn >> vm->geo.huge_order) << shift;
+    addr_t last = start + (((addr_t)1 << shift) - 1);
+    for (uint i = 0; i < vm->config.num_huge_ranges; i++) {
+        if (start >= vm->config.huge_ranges[i].start && last < vm->config.huge_ranges[i].end) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// block b's frames are free or hold pages of region key, none is protected
+static int block_usable(vmsim_ctx* vm, uint64_t b, vpn_t key, int own_only)
+{
+    for (ppn_t f = b << vm->geo.huge_order; f < (b + 1) << vm->geo.huge_order; f++) {
+        const FT_entry* e = &vm->frametable[f];
+        if (e->protected || (own_only && e->mapped && region_key(vm, e->asid, e->vpn) != key)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// a block of free frames, -1 if there is none
+static int64_t free_block(vmsim_ctx* vm)
+{
+    uint order = vm->geo.huge_order;
+    uint64_t blocks = vm->geo.num_frames >> order;
+    if (order >= 6) {
+        uint64_t words = 1ULL << (order - 6);
+        for (uint64_t b = vm->free_hint / words; b < blocks; b++) {
+            frames_touch(vm, (b + 1) << order);
+            uint64_t w = 0;
+            while (w < words && vm->free_frames[b * words + w] == ~0ULL) {
+                w++;
+            }
+            if (w == words) {
+                return b;
+            }
+        }
+    } else {
+        uint64_t mask = (1ULL << (1U << order)) - 1;
+        for (uint64_t b = ((uint64_t)vm->free_hint * 64) >> order; b < blocks; b++) {
+            frames_touch(vm, (b + 1) << order);
+            uint64_t f = b << order;
+            if ((vm->free_frames[f / 64] >> (f % 64) & mask) == mask) {
+                return b;
+            }
+        }
+    }
+    return -1;
+}
+
+/*
+* Pick the block of frames for the huge page of region key, whose
+* first page is first: one the region already fills with free frames
+* around its pages, a free one, or else the block of the policy's
+* victim, whose pages will be evicted. If that one holds page tables
+* the victim stays (as if just used) and the next block from huge_hand
+* without any is taken instead.
+* returns the block, -1 if every block holds page tables
 */
-vpn_t vpn_offset(addr_t vaddr) {
-    int offset = log2(PAGE_SIZE);
-    addr_t mask = 0xFFFFFFFF;
-    mask = mask << offset;
-    mask = ~mask;
-    // printf("MASK: %d\n", mask);
-    // printf("vaddr: %lu\n", vaddr);
-    // printf("vpn: %lu\n", (vaddr & mask));
-    return (vaddr & mask) >> offset;
+static int64_t huge_block(vmsim_ctx* vm, vpn_t first, vpn_t key)
+{
+    uint order = vm->geo.huge_order;
+    uint64_t blocks = vm->geo.num_frames >> order;
+    uint64_t last = UINT64_MAX;
+    for (uint64_t i = 0; i < (1ULL << order); i++) {
+        uint64_t pte = pte_get(vm, first + i);
+        uint64_t b = (pte >> PTE_PPN_SHIFT) >> order;
+        if ((pte & PTE_VALID) && b != last && b < blocks && block_usable(vm, b, key, 1)) {
+            return b;
+        }
+        last = b;
+    }
+    int64_t b = free_block(vm);
+    if (b >= 0 || !vm->num_evictable) {
+        return b;
+    }
+    ppn_t victim = vm->policy->victim(vm);
+    b = victim >> order;
+    if ((uint64_t)b < blocks && block_usable(vm, b, key, 0)) {
+        return b;
+    }
+    vm->policy->map(vm, victim);
+    for (uint64_t k = 0; k < blocks; k++) {
+        b = (vm->huge_hand + k) % blocks;
+        if (block_usable(vm, b, key, 0)) {
+            vm->huge_hand = (b + 1) % blocks;
+            return b;
+        }
+    }
+    return -1;
 }
-// ---------------------------------------------------------
+
 /*
-* Updates the TLB
-* If you hit in the tlb, you still need to update LRU status
-* as well as dirty status:
-*   Remember, if the dirty bit is newly set, you should go to memory and
-*   mark the corresponding PTE dirty
-* If you miss in the TLB, you need to replace:
-*   First, check the TLB for any invalid entries
-*   If one is found, install the vaddr mapping into it
-*   Otherwise, consult an LRU replacement policy
-*
-* When a TLB entry is kicked out, what should you do? Anything?
+* Map vpn's region (of the running process) as one huge page
+* Its resident pages move into the block huge_block() picks, keeping
+* their data and dirty bits, and its other pages are mapped there
+* too without a page fault each.
+* returns vpn's new frame, -1 if there is no block to be had
 */
-void update_TLB(addr_t vaddr, uint write, addr_t paddr, status_t tlb_access)
+static int64_t huge_promote(vmsim_ctx* vm, vpn_t vpn, huge_region_t* r)
 {
-    // address conversion
-    vpn_t vpn = vpn_translation(vaddr);
-    vpn_t offset = vpn_offset(vaddr);
-    int offset_length = log2(PAGE_SIZE);
-    // new ppn to store on the miss -> whether found invalid or replace:
-    ppn_t ppn = paddr >> offset_length;
-    // TLB ACCESSING
-    int foundInvalid = 0;
-    vpn_t vpnOld = 0;
-    int valid = 0;
-    uint8_t dirty = 0;
-    if (tlb_access == HIT) { // HIT
-        for(int j = 0; j < TLB_SIZE; j++) {
-            if (TLB[j].vpn == vpn && TLB[j].valid == 1) {
-                TLB[j].age_bit = accesses; //increment the age bit
-                                        // you update the PAGE TABLE
-                // extract the dirty bit
-                if (write) {
-                    // update TLB
-                    TLB[j].dirty = 1;
-                    // update
-                    // concat this to override -> mark the corresponding PTE dirty
-                    pagetable[vpn].ppn_valid_dirty = pagetable[vpn].ppn_valid_dirty | 0x1;
-                }
-            }
+    uint64_t count = 1ULL << vm->geo.huge_order;
+    vpn_t first = vpn & ~(count - 1);
+    vpn_t key = region_key(vm, vm->cur_asid, vpn);
+    // the region's tables first, they may take frames themselves
+    if (vm->geo.pt_levels > 1) {
+        for (uint64_t i = 0; i < count; i += 1ULL << vm->geo.pt_bits) {
+            radix_walk(vm, first + i, 1, 0);
         }
-    } else { // MISS
-        // printf("HERE");
-        // data to confirm the min access age_bit
-        int min = TLB[0].age_bit;
-        int minIndex = 0;
-        // check for invalid entries
-        for(int j = 0; j < TLB_SIZE; j++) {
-            if (TLB[j].valid == 0) {
-                // update valid, VPN and ppn
-                TLB[j].valid = 1;
-                TLB[j].vpn = vpn;
-                TLB[j].ppn = ppn;
-                TLB[j].age_bit = accesses;
-                foundInvalid = 1;
-                // write through
-                vpnOld = TLB[j].vpn;
-                // write MISS
-                if (write) {
-                    TLB[j].dirty = 1;
-                    dirty = TLB[j].dirty;
-                } else { // read miss
-                    TLB[j].dirty = 0;
-                    dirty = TLB[j].dirty;
-                }
-                valid = TLB[j].valid;
-                // printf("here: %lu\n", vpnOld);
-                // write through!!
-                pagetable[vpnOld].ppn_valid_dirty = (TLB[j].ppn << 2) | valid << 1 | dirty;
-
-                break;
-            }
+        if (vm->error) {
+            return -1;
         }
-        if (!foundInvalid) {
-        // look for the smallest age bit
-            for(int j = 1; j < TLB_SIZE; j++) {
-                if (TLB[j].age_bit < min) {
-                    min = TLB[j].age_bit;
-                    minIndex = j;
-                }
+    }
+    int64_t b = huge_block(vm, first, key);
+    if (b < 0) {
+        return -1;
+    }
+    ppn_t base = b << vm->geo.huge_order;
+    // the region's pages leave their frames (one shootdown for all)...
+    int moved = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t pte = pte_get(vm, first + i);
+        vm->huge_moved[i] = (pte & PTE_VALID) != 0;
+        if (vm->huge_moved[i]) {
+            ppn_t f = pte >> PTE_PPN_SHIFT;
+            if (vm->prefetched && vm->prefetched[f]) {
+                vm->huge_moved[i] |= 2;
             }
-            // LRU REPLACEMENT POLICY
-            // KICK OUT
-            vpnOld = TLB[minIndex].vpn;
-            dirty = TLB[minIndex].dirty;
-            valid = TLB[minIndex].valid;
-            // printf("here: %lu\n", vpnOld);
-            pagetable[vpnOld].ppn_valid_dirty = (TLB[minIndex].ppn << 2) | valid << 1 | dirty ;
-            // printf("here: %hu\n", pagetable[vpnOld].ppn_valid_dirty);
-            // update with new
-            TLB[minIndex].valid = 1;
-            TLB[minIndex].vpn = vpn;
-            TLB[minIndex].ppn = ppn;
-            // update the accsess
-            if (write) {
-                // printf("WRITE\n");
-                TLB[minIndex].dirty = 1;
-            } else {
-                // printf("READ\n");
-                TLB[minIndex].dirty = 0;
+            memcpy(vm->huge_buffer + i * vm->geo.page_size, vm->mem + (addr_t)f * vm->geo.page_size, vm->geo.page_size);
+            pte |= tlb_dirty(vm, vm->asid_key | (first + i));
+            pte_set(vm, first + i, pte);
+            vm->huge_moved[i] |= (pte & PTE_DIRTY) << 2;  // (gone from an inverted table)
+            tlb_shootdown(vm, vm->asid_key | (first + i));
+            release_frame(vm, f);
+            moved = 1;
+        }
+    }
+    if (moved) {
+        shootdown_ipis(vm, vm->cur_asid);
+    }
+    // ...the block's other pages are evicted...
+    frames_touch(vm, base + count);
+    for (ppn_t f = base; f < base + count; f++) {
+        if (vm->frametable[f].mapped) {
+            evict_frame(vm, f);
+            if (vm->policy->unmap) {
+                vm->policy->unmap(vm, f);
             }
-            TLB[minIndex].age_bit = accesses;
+        } else {
+            vm->free_frames[f / 64] &= ~(1ULL << (f % 64));
+        }
+    }
+    // ...and the region takes the block
+    for (uint64_t i = 0; i < count; i++) {
+        ppn_t f = base + i;
+        vm->frametable[f].mapped = 1;
+        vm->frametable[f].asid = vm->cur_asid;
+        vm->frametable[f].vpn = first + i;
+        vm->policy->map(vm, f);
+        if (vm->huge_moved[i]) {
+            memcpy(vm->mem + (addr_t)f * vm->geo.page_size, vm->huge_buffer + i * vm->geo.page_size, vm->geo.page_size);
         }
+        if (vm->prefetched) {
+            vm->prefetched[f] = (vm->huge_moved[i] >> 1) & 1;
+        }
+        uint64_t dirty = (pte_get(vm, first + i) & dirty_mask) | vm->huge_moved[i] >> 2;
+        pte_set(vm, first + i, (uint64_t)f << PTE_PPN_SHIFT | valid_mask | dirty);
     }
+    r->resident = count;
+    r->huge = 1;
+    vm->count.huge_promotions++;
+    return base + (vpn - first);
 }
 
+/*
+* Count a page fault's new page in its region and promote the region
+* once it qualifies
+* returns vpn's frame, ppn or its frame in the new huge page
+*/
+static ppn_t huge_fault(vmsim_ctx* vm, vpn_t vpn, ppn_t ppn)
+{
+    huge_region_t* r = huge_region(&vm->huge_regions, region_key(vm, vm->cur_asid, vpn), 1);
+    if (!r) {
+        vm_fail(vm, "Out of memory for huge page regions");
+        return ppn;
+    }
+    r->resident++;
+    if (!r->huge && ((vm->geo.huge_promote && r->resident >= vm->geo.huge_promote) ||
+                     huge_in_range(vm, vpn))) {
+        int64_t f = huge_promote(vm, vpn, r);
+        if (f >= 0) {
+            return f;
+        }
+    }
+    return ppn;
+}
 
 /*
-* Called on a page fault
+* Map the page of vaddr
 * First, search the frame table, starting at fte 0 and iterating linearly through all
 * the frame table entries looking for unmapped unprotected frame.
 * If one is found, use it.
@@ -386,103 +2095,166 @@ void update_TLB(addr_t vaddr, uint write, addr_t paddr, status_t tlb_access)
 *
 * returns the PPN of the new mapped frame
 */
-uint32_t page_fault(addr_t vaddr, uint write)
+static uint32_t fault_in(vmsim_ctx* vm, addr_t vaddr, uint write)
 {
     // virtual address translation
-    vpn_t vpn = vpn_translation(vaddr);
-    vpn_t offset = vpn_offset(vaddr);
-    // this will be the open page
-    int found = 0;
-    int foundPage = 0;
-    // if the frame at specific index IS NOT mapepd or protected
-    // save this index
-    for(int i = 0; i < 512; i++) {
-        if (frametable[i].mapped == 0 && frametable[i].protected == 0) {
-            foundPage = i;
-            found = 1;
-            break;
-        }
+    vpn_t vpn = vpn_translation(vm, vaddr);
+    vpn_t offset = vpn_offset(vm, vaddr);
+    // a radix page table needs vpn's tables before the data frame is
+    // picked, they may take a frame themselves
+    if (vm->geo.pt_levels > 1) {
+        radix_walk(vm, vpn, 1, 0);
     }
+    // this will be the open page
+    // the frame with the lowest index that IS NOT mapped or protected
+    int foundPage = take_free_frame(vm);
+    int found = foundPage >= 0;
     // rand num
     // num = (rand() % (upper – lower + 1)) + lower
     // random index
     int randFrame;
-    // page table info --------
-    PT_entry newPTE;
     // dirty info
     int dirty = 0;
-    // pyhsical page number masked
-    int ppn_mask = 0x7FC; // -> 0000011111111100
     // page
     ppn_t ppn;
     // if found -> map it, include the vpn, return the foundIndex
     if (found) { // empty
-        // regCount++;
         // set parameters for the frameTable
-        frametable[foundPage].mapped = 1;
-        frametable[foundPage].vpn = vpn;
+        vm->frametable[foundPage].mapped = 1;
+        vm->frametable[foundPage].asid = vm->cur_asid;
+        vm->frametable[foundPage].vpn = vpn;
+        vm->policy->map(vm, foundPage);
         // update the pagetable -> _ _ _ _ _ 1 1 1 1 1 1 1 1 1 0 0
-        // save the dirty bits
-        dirty = pagetable[vpn].ppn_valid_dirty & dirty_mask;
+        // save the dirty bits (a write fault's, if an inverted page
+        // table has no entry to keep it in)
+        dirty = (pte_get(vm, vpn) & dirty_mask) | (write ? dirty_mask : 0);
         // concate it with the page found and make it valid
         // shift it over 2 (valid | dirty)
         // make it valid        -> _ _ _ _ _ 1 1 1 1 1 1 1 1 1 0 1
         // build the page tabel entry -> make it valid and save the dirty
-        pagetable[vpn].ppn_valid_dirty = foundPage << 2 | 0x2 | dirty;
+        pte_set(vm, vpn, (uint64_t)foundPage << PTE_PPN_SHIFT | valid_mask | dirty);
         // return
-        return foundPage;
+        return vm->geo.huge_order ? huge_fault(vm, vpn, foundPage) : foundPage;
     } else { // random
-        // randCount++;
-        ppn_t randPage = (rand() % 512);
-        // continue to search for a not protected index
-        while (frametable[randPage].protected) {
-            randPage = (rand() % 512);
-        }
-        // save the old VPN to set the valid bit to 0
-        vpn_t vpnOld = frametable[randPage].vpn;
-        // old dirty
-        dirty = pagetable[vpnOld].ppn_valid_dirty & dirty_mask;
-        // now build the page table entry
-        // mark the old as invalid
-        /// -> 0 0 0 0 0 1 1 1 1 1 1 1 1 1 0 1
-        // -> this makes it invalid
-        pagetable[vpnOld].ppn_valid_dirty = randPage << 2 | dirty;
-        // update the old vpnTemp
-        // update the frametable
-        frametable[randPage].mapped = 1;
-        frametable[randPage].vpn = vpn;
-        // is this frame being replaced PTE dirty using the mask.
-        //printf("HERE\n");
-        dirty = pagetable[vpnOld].ppn_valid_dirty & dirty_mask;
-        // printf("dirty: %d", dirty);
-        if (dirty) { // if the old is dirty
-            disk_writes++;
+        ppn_t randPage = evict_victim(vm);
+        if (vm->error) {
+            return randPage;
         }
+        // update the frametable
+        vm->frametable[randPage].mapped = 1;
+        vm->frametable[randPage].asid = vm->cur_asid;
+        vm->frametable[randPage].vpn = vpn;
+        vm->policy->map(vm, randPage);
         // update the pagetable -> _ _ _ _ _ 1 1 1 1 1 1 1 1 1 0 0
         // save the valid and dirty bits
-        dirty = pagetable[vpn].ppn_valid_dirty & dirty_mask;
+        dirty = (pte_get(vm, vpn) & dirty_mask) | (write ? dirty_mask : 0);
         // concate it with the page found and make it valid
         // shift it over 2 (valid | dirty)
         // make it valid        -> _ _ _ _ _ 1 1 1 1 1 1 1 1 1 1 0
         // build the page table entry
-        pagetable[vpn].ppn_valid_dirty = randPage << 2 | 0x2 | dirty;
-        // *-------------------------------------------------------------
-        // if the new randPage is in the TLB -> make invalid
-        // you do not want this mapping to be used.
-        // *-------------------------------------------------------------
-        for(int j = 0; j < TLB_SIZE; j++) {
-            if (TLB[j].ppn == randPage) { 
-                TLB[j].valid = 0; // make sure that this mapping cannot be used.
+        pte_set(vm, vpn, (uint64_t)randPage << PTE_PPN_SHIFT | valid_mask | dirty);
+        return vm->geo.huge_order ? huge_fault(vm, vpn, randPage) : randPage;
+    }
+    return 0;
+}
+
+/*
+* Called on a page fault
+* With vm_config.fault_cluster the other pages of vaddr's aligned
+* cluster that aren't resident are faulted in first (read-around),
+* so that their frames can't be taken from vaddr's page.
+* returns the PPN of vaddr's frame
+*/
+uint32_t page_fault(vmsim_ctx* vm, addr_t vaddr, uint write)
+{
+    if (vm->prefetched) {
+        vpn_t vpn = vpn_translation(vm, vaddr);
+        vpn_t first = vpn & ~(vpn_t)(vm->config.fault_cluster - 1);
+        for (vpn_t v = first; v < first + vm->config.fault_cluster && v < vm->geo.num_pages; v++) {
+            if (v != vpn && !(pte_get(vm, v) & valid_mask)) {
+                vm->prefetched[fault_in(vm, (addr_t)v << vm->geo.page_shift, 0)] = 1;
+                vm->count.fault_prefetches++;
+            }
+        }
+        // a huge page promotion may have brought it in with them
+        uint64_t pte = pte_get(vm, vpn);
+        if (pte & valid_mask) {
+            if (write && !(pte & dirty_mask)) {
+                pte_set(vm, vpn, pte | dirty_mask);
             }
+            return pte >> PTE_PPN_SHIFT;
         }
-        // *-------------------------------------------------------------
-        return randPage;
-        // If the frame being accessed is in the TLB, mark it
-        // invalid in the TLB (here, not in update_TLB)
     }
-    return 0;
+    return fault_in(vm, vaddr, write);
+}
+
+// a page brought in around a page fault is accessed
+ALWAYS_INLINE void prefetch_used(vmsim_ctx* vm, ppn_t ppn)
+{
+    if (vm->prefetched && vm->prefetched[ppn]) {
+        vm->prefetched[ppn] = 0;
+        vm->count.fault_prefetch_hits++;
+    }
+}
+
+/*
+* Take a frame for a radix page table
+* A free frame if there is one, otherwise the policy's victim. The
+* frame becomes protected, so it leaves the evictable list.
+* returns the zeroed frame
+*/
+static ppn_t alloc_table(vmsim_ctx* vm)
+{
+    int frame = take_free_frame(vm);
+    if (frame < 0) {
+        frame = evict_victim(vm);
+        if (vm->error) {
+            return frame;
+        }
+    }
+    vm->frametable[frame].mapped = 1;
+    vm->frametable[frame].protected = 1;
+    vm->frametable[frame].asid = 0;
+    vm->frametable[frame].vpn = 0;
+    // swap it out of the evictable list
+    uint32_t pos = vm->evictable_pos[frame];
+    ppn_t last = vm->evictable[--vm->num_evictable];
+    vm->evictable[pos] = last;
+    vm->evictable_pos[last] = pos;
+    if (vm->policy->pin) {
+        vm->policy->pin(vm, frame);
+    }
+    memset(vm->mem + (addr_t)frame * vm->geo.page_size, 0, vm->geo.page_size);
+    vm->count.pt_table_frames++;
+    return frame;
+}
+
+/*
+* A fast-forward of sampled simulation (sample.h) simulates its
+* accesses like detailed ones, TLBs included, as their write-backs
+* decide which dirty bits survive. Its counts are dropped at the end,
+* except as ff_accesses and its disk writes as ff_disk_writes; the
+* accesses so far are charged to their process and core first, and
+* its own aren't (see end_slice()).
+*/
+static void ff_begin(vmsim_ctx* vm, vm_counters_t* saved)
+{
+    end_slice(vm);
+    *saved = vm->count;
+    vm->fast_forwarding = 1;
+}
+
+// n accesses were fast-forwarded since ff_begin()
+static void ff_end(vmsim_ctx* vm, const vm_counters_t* saved, uint64_t n)
+{
+    counter_t disk_writes = vm->count.disk_writes - saved->disk_writes;
+    vm->count = *saved;
+    vm->count.ff_accesses += n;
+    vm->count.ff_disk_writes += disk_writes;
+    vm->fast_forwarding = 0;
 }
 
+ALWAYS_INLINE ppn_t translate(vmsim_ctx* vm, addr_t vaddr, vpn_t vpn, uint write, uint pte_bytes);
 
 /* Called on each access
 * If the access is a write, update the memory in mem, return data
@@ -490,30 +2262,633 @@ uint32_t page_fault(addr_t vaddr, uint write)
 * Perform accessed in the following order
 * Address -> read TLB -> read PT -> Update TLB -> Read Memory
 */
-byte_t memory_access(addr_t vaddr, uint write, byte_t data)
+byte_t memory_access(vmsim_ctx* vm, addr_t vaddr, uint write, byte_t data)
 {
     addr_t paddr;
+    // a stopped simulation (vmsim_error()) does nothing
+    if (vm->error) {
+        return 0;
+    }
+    uint64_t record = vm->count.accesses + vm->count.ff_accesses;
+    // sampling: fast-forwarded accesses only read mem[]
+    uint64_t run;
+    if (vm->config.sample_period && sample_phase(vm, 1, &run) == SAMPLE_FAST_FORWARD) {
+        vm_counters_t saved;
+        ff_begin(vm, &saved);
+        ppn_t ppn = translate(vm, vaddr, vpn_translation(vm, vaddr), write, 0);
+        if (vm->policy->access) {
+            vm->policy->access(vm, ppn);
+        }
+        prefetch_used(vm, ppn);
+        ff_end(vm, &saved, 1);
+        if (vm->error) {
+            vm->error_record = record;
+            return 0;
+        }
+        paddr = (addr_t)ppn << vm->geo.page_shift | vpn_offset(vm, vaddr);
+        sample_advance(vm, 1);
+        return vm->mem[paddr];
+    }
     // First, we check the TLB
-    status_t tlbAccess = check_TLB(vaddr, write, &paddr);
+    PROF_BEGIN(vm, PROF_CHECK_TLB);
+    status_t tlbAccess = check_TLB(vm, vaddr, write, &paddr);
+    PROF_END(vm, PROF_CHECK_TLB);
     // access
-    accesses++;
+    vm->count.accesses++;
+    status_t pgtblAccess = HIT;
     // check the TLB with the enum HIT or MISS
     if (tlbAccess == MISS) {
-        status_t pgtblAccess = check_PT(vaddr, write, &paddr);
+        PROF_BEGIN(vm, PROF_CHECK_PT);
+        pgtblAccess = check_PT(vm, vaddr, write, &paddr);
+        PROF_END(vm, PROF_CHECK_PT);
         // the address gets assigned inside of page fault
     }
-    update_TLB(vaddr, write, paddr, tlbAccess); //update TLB after each access
+    PROF_BEGIN(vm, PROF_UPDATE_TLB);
+    update_TLB(vm, vaddr, write, paddr, tlbAccess); //update TLB after each access
+    PROF_END(vm, PROF_UPDATE_TLB);
+    if (vm->error) {
+        vm->error_record = record;
+        return 0;
+    }
+    if (vm->policy->access) vm->policy->access(vm, paddr >> vm->geo.page_shift);
+    prefetch_used(vm, paddr >> vm->geo.page_shift);
+    STAT_REUSE(vm, paddr >> vm->geo.page_shift, pgtblAccess == MISS);
+    if (vm->count.accesses == vm->stats.next) {
+        stats_interval(vm);
+    }
+    if (vm->config.sample_period) {
+        sample_advance(vm, 1);
+    }
     // Do memory stuff
-    if(write) mem[paddr] = data; //Update mem on write
+    if(write) vm->mem[paddr] = data; //Update mem on write
     // printf("address: %lu\n", paddr);
-    return mem[paddr];
+    return vm->mem[paddr];
+
+}
+
+// ---------------------------------------------------------
+//                    Batched access path
+// ---------------------------------------------------------
+// translate() and batch_loop() take the geometry as arguments and
+// are always inlined, so each instantiation below for a common
+// geometry gets its shift, masks and PTE width as constants.
+// pte_bytes 0 -> radix or inverted page table, PTEs go through the walker.
+// ---------------------------------------------------------
+ALWAYS_INLINE uint64_t translate_pte_get(vmsim_ctx* vm, vpn_t vpn, uint pte_bytes, int count)
+{
+    if (!pte_bytes) {
+        return count ? pte_walk(vm, vpn) : pte_get(vm, vpn);
+    }
+    if (count) {
+        vm->count.pt_walk_refs++;
+    }
+    return pte_load(vm, vpn, pte_bytes);
+}
+
+ALWAYS_INLINE void translate_pte_set(vmsim_ctx* vm, vpn_t vpn, uint pte_bytes, uint64_t pte)
+{
+    if (!pte_bytes) {
+        pte_set(vm, vpn, pte);
+    } else {
+        pte_store(vm, vpn, pte_bytes, pte);
+    }
+}
 
+// translate() past a TLB miss: page table, page fault, TLB fill
+ALWAYS_INLINE ppn_t translate_walk(vmsim_ctx* vm, addr_t vaddr, vpn_t vpn, uint write, uint pte_bytes)
+{
+    // page table
+    ppn_t ppn;
+    uint64_t pte = translate_pte_get(vm, vpn, pte_bytes, 1);
+    if (pte & valid_mask) {
+        ppn = pte >> PTE_PPN_SHIFT;
+    } else {
+        vm->count.page_faults++;
+        if (write) {
+            translate_pte_set(vm, vpn, pte_bytes, pte | dirty_mask);
+        }
+        ppn = page_fault(vm, vaddr, write);
+    }
+    // install, a huge page's entry from its region's first frame
+    vpn_t key = vm->asid_key | vpn;
+    ppn_t first = ppn;
+    int huge = vm->geo.huge_order && huge_mapped(vm, vpn);
+    if (huge) {
+        key = huge_key(vm, vm->asid_key, vpn);
+        first -= vpn & (((vpn_t)1 << vm->geo.huge_order) - 1);
+    }
+    TLB_entry old;
+    tlb_insert(&vm->TLB, key, first, write ? 1 : 0, &old);
+    if (vm->STLB.sets) {
+        stlb_walk_fill(vm, key, first, write ? 1 : 0, &old);
+    } else if (old.valid && ((old.vpn & ~VPN_MASK) != vm->asid_key || asid_shared(vm, vm->cur_asid))) {
+        // another process's entry, or one whose PTE another core may have dirtied
+        tlb_writeback(vm, &old);
+    } else if (old.valid) {
+        // write back the entry being kicked out
+        translate_pte_set(vm, old.vpn & VPN_MASK, pte_bytes, (uint64_t)old.ppn << PTE_PPN_SHIFT | valid_mask | old.dirty);
+    }
+    if (huge) {
+        if (write) {
+            translate_pte_set(vm, vpn, pte_bytes, translate_pte_get(vm, vpn, pte_bytes, 0) | dirty_mask);
+        }
+    } else if (!old.valid) {
+        translate_pte_set(vm, vpn, pte_bytes, (uint64_t)ppn << PTE_PPN_SHIFT | valid_mask | (write ? dirty_mask : 0));
+    }
+    return ppn;
+}
+
+/*
+* check_TLB() + check_PT() + update_TLB() for one access
+* The hit check and the LRU update share one set lookup.
+* returns the PPN for vpn, counters and dirty bits as memory_access()
+*/
+ALWAYS_INLINE ppn_t translate(vmsim_ctx* vm, addr_t vaddr, vpn_t vpn, uint write, uint pte_bytes)
+{
+    vm->count.accesses++;
+    uint32_t j = tlb_find(vm, vpn);
+    if (j != TLB_NIL) {
+        vm->count.tlb_hits++;
+        vm->count.huge_tlb_hits += tlb_is_huge(&vm->TLB, j);
+        tlb_touch(&vm->TLB, j);
+    } else {
+        vm->count.tlb_misses++;
+        if ((!vm->STLB.sets && !vm->PB.sets) || (j = tlb_refill(vm, vpn)) == TLB_NIL) {
+            return translate_walk(vm, vaddr, vpn, write, pte_bytes);
+        }
+    }
+    if (write) {
+        vm->TLB.dirty[j] = 1;
+        translate_pte_set(vm, vpn, pte_bytes, translate_pte_get(vm, vpn, pte_bytes, 0) | dirty_mask);
+    }
+    return tlb_frame(vm, j, vpn);
+}
+
+/*
+* fast -> the records are fast-forwarded (sampling): no writes to mem[]
+* returns how many records were simulated, fewer than n if the
+* simulation stopped at the next one
+*/
+ALWAYS_INLINE size_t batch_loop(vmsim_ctx* vm, const record_t* recs, size_t n, byte_t* out, int fast,
+                                uint page_shift, uint pte_bytes, addr_t va_mask)
+{
+    addr_t offset_mask = ((addr_t)1 << page_shift) - 1;
+    for (size_t i = 0; i < n; i++) {
+        if (recs[i].cpu != vm->cur_core && vm_core(vm, recs[i].cpu) != 0) {
+            return i;
+        }
+        if (recs[i].pid != vm->cur_pid && vm_switch(vm, recs[i].pid) != 0) {
+            return i;
+        }
+        addr_t vaddr = recs[i].pa & va_mask;
+        uint write = recs[i].op == 'w';
+        vpn_t vpn = vaddr >> page_shift;
+        ppn_t ppn = translate(vm, vaddr, vpn, write, pte_bytes);
+        if (vm->policy->access) {
+            vm->policy->access(vm, ppn);
+        }
+        prefetch_used(vm, ppn);
+        if (vm->error) {
+            return i;
+        }
+        addr_t paddr = (addr_t)ppn << page_shift | (vaddr & offset_mask);
+        if (write && !fast) {
+            vm->mem[paddr] = (byte_t)recs[i].size;
+        }
+        if (out) {
+            out[i] = vm->mem[paddr];
+        }
+    }
+    return n;
+}
+
+// any geometry
+static size_t batch_generic(vmsim_ctx* vm, const record_t* recs, size_t n, byte_t* out, int fast)
+{
+    return batch_loop(vm, recs, n, out, fast, vm->geo.page_shift,
+                      vm->geo.pt_levels > 1 || vm->config.inverted ? 0 : vm->geo.pte_bytes, vm->geo.va_mask);
+}
+
+// the default: 4 KiB pages, 2 byte PTEs, 24 bit addresses
+static size_t batch_4k_pte2_va24(vmsim_ctx* vm, const record_t* recs, size_t n, byte_t* out, int fast)
+{
+    return batch_loop(vm, recs, n, out, fast, 12, 2, 0x00FFFFFF);
+}
+
+// 4 KiB pages, up to 2^30 frames (4 TiB)
+static size_t batch_4k_pte4(vmsim_ctx* vm, const record_t* recs, size_t n, byte_t* out, int fast)
+{
+    return batch_loop(vm, recs, n, out, fast, 12, 4, vm->geo.va_mask);
+}
+
+// 16 KiB pages, up to 2^30 frames (16 TiB)
+static size_t batch_16k_pte4(vmsim_ctx* vm, const record_t* recs, size_t n, byte_t* out, int fast)
+{
+    return batch_loop(vm, recs, n, out, fast, 14, 4, vm->geo.va_mask);
+}
+
+// 4 KiB pages, radix or inverted page table
+static size_t batch_4k_radix(vmsim_ctx* vm, const record_t* recs, size_t n, byte_t* out, int fast)
+{
+    return batch_loop(vm, recs, n, out, fast, 12, 0, vm->geo.va_mask);
+}
+
+static void pick_batch_fn(vmsim_ctx* vm)
+{
+    vm->batch_fn = batch_generic;
+    if (vm->geo.pt_levels > 1 || vm->config.inverted) {
+        if (vm->geo.page_shift == 12) {
+            vm->batch_fn = batch_4k_radix;
+        }
+    } else if (vm->geo.page_shift == 12 && vm->geo.pte_bytes == 2 && vm->geo.va_bits == 24) {
+        vm->batch_fn = batch_4k_pte2_va24;
+    } else if (vm->geo.page_shift == 12 && vm->geo.pte_bytes == 4) {
+        vm->batch_fn = batch_4k_pte4;
+    } else if (vm->geo.page_shift == 14 && vm->geo.pte_bytes == 4) {
+        vm->batch_fn = batch_16k_pte4;
+    }
+}
+
+/*
+* memory_access() over an array of trace records
+* Addresses are masked to vm_config.va_bits like the trace readers do.
+* A record of another core than the running one is a vm_core(), of
+* another process a vm_switch() on its core.
+* If out is not NULL, out[i] gets the value memory_access() returns.
+* returns 0, -1 if the simulation stopped (vmsim_error() has why and
+* at which record)
+*/
+int memory_access_batch(vmsim_ctx* vm, const record_t* recs, size_t n, byte_t* out)
+{
+    if (vm->error) {
+        return -1;
+    }
+    uint64_t first = vm->count.accesses + vm->count.ff_accesses;
+    size_t done = 0;
+#ifdef VMSIM_STATS
+    // instrumented builds time and count what memory_access() does
+    for (; done < n; done++) {
+        if (vm_core(vm, recs[done].cpu) != 0 || vm_switch(vm, recs[done].pid) != 0) {
+            break;
+        }
+        byte_t b = memory_access(vm, recs[done].pa & vm->geo.va_mask, recs[done].op == 'w',
+                                 (byte_t)recs[done].size);
+        if (vm->error) {
+            break;
+        }
+        if (out) {
+            out[done] = b;
+        }
+    }
+#else
+    // in runs of up to the next interval end or sampling phase change
+    while (done < n) {
+        uint64_t run = n - done;
+        size_t ran;
+        byte_t* run_out = out ? out + done : NULL;
+        if (vm->config.sample_period && sample_phase(vm, run, &run) == SAMPLE_FAST_FORWARD) {
+            vm_counters_t saved;
+            ff_begin(vm, &saved);
+            ran = vm->batch_fn(vm, recs + done, run, run_out, 1);
+            ff_end(vm, &saved, ran);
+        } else {
+            if (vm->stats.next - vm->count.accesses < run) {
+                run = vm->stats.next - vm->count.accesses;
+            }
+            ran = vm->batch_fn(vm, recs + done, run, run_out, 0);
+            if (vm->count.accesses == vm->stats.next) {
+                stats_interval(vm);
+            }
+        }
+        if (vm->config.sample_period) {
+            sample_advance(vm, ran);
+        }
+        done += ran;
+        if (ran < run || vm->error) {
+            break;
+        }
+    }
+#endif
+    if (vm->error) {
+        vm->error_record = first + done;
+        return -1;
+    }
+    return 0;
 }
 
 /* You may not change this method in your final submission!!!!!
 *   Furthermore, your code should not have any extra print statements
 */
-void vm_print_stats()
+void vm_print_stats(vmsim_ctx* vm)
+{
+    // sampled: the totals the windows' rates extrapolate to, then the
+    // windows, fast-forwarded accesses and disk writes and each rate
+    // with its 95% interval; the lines below count only the detailed
+    // accesses, but for timing, extrapolated too, and the per process
+    // and per core lines, left out (a fast-forward has no slices)
+    if (vm->config.sample_period) {
+        vm_estimate_t e;
+        vm_estimate(vm, &e);
+        counter_t misses = e.tlb_miss_rate * e.accesses + 0.5;
+        printf("%llu, %llu, %llu, %llu, %llu, %llu\n", e.accesses, e.accesses - misses, misses,
+               (counter_t)(e.fault_rate * e.accesses + 0.5), (counter_t)(e.disk_write_rate * e.accesses + 0.5),
+               vm->count.shutdown_writes);
+        printf("sampling, %llu, %llu, %llu, %.6f, %.6f, %.6f, %.6f, %.6f, %.6f\n", e.windows, vm->count.ff_accesses,
+               vm->count.ff_disk_writes, e.tlb_miss_rate, e.tlb_miss_ci, e.fault_rate, e.fault_ci, e.disk_write_rate, e.disk_write_ci);
+        printf("detailed, ");
+    }
+    printf("%llu, %llu, %llu, %llu, %llu, %llu", vm->count.accesses, vm->count.tlb_hits, vm->count.tlb_misses, vm->count.page_faults, vm->count.disk_writes, vm->count.shutdown_writes);
+    // radix page tables: walk references and table frames too
+    if (vm->geo.pt_levels > 1) {
+        printf(", %llu, %llu", vm->count.pt_walk_refs, vm->count.pt_table_frames);
+    }
+    printf("\n");
+    // per level hits and misses of the rest of the hierarchy
+    if (vm->STLB.sets) {
+        printf("l2 tlb, %llu, %llu\n", vm->count.l2_tlb_hits, vm->count.l2_tlb_misses);
+    }
+    if (vm->PWC.sets) {
+        printf("pwc, %llu, %llu\n", vm->count.pwc_hits, vm->count.pwc_misses);
+    }
+    // prefetches issued and used, accuracy (used / issued) and coverage
+    // (TLB: share of L1 misses, faults: share of the faults there would be)
+    if (vm->PB.sets) {
+        printf("tlb prefetch, %llu, %llu, %llu, %.4f, %.4f\n", vm->count.tlb_prefetch_walks, vm->count.tlb_prefetches,
+               vm->count.tlb_prefetch_hits, vm->count.tlb_prefetches ? (double)vm->count.tlb_prefetch_hits / vm->count.tlb_prefetches : 0.0,
+               vm->count.tlb_misses ? (double)vm->count.tlb_prefetch_hits / vm->count.tlb_misses : 0.0);
+    }
+    if (vm->prefetched) {
+        printf("fault prefetch, %llu, %llu, %.4f, %.4f\n", vm->count.fault_prefetches, vm->count.fault_prefetch_hits,
+               vm->count.fault_prefetches ? (double)vm->count.fault_prefetch_hits / vm->count.fault_prefetches : 0.0,
+               (double)vm->count.fault_prefetch_hits / (vm->count.fault_prefetch_hits + vm->count.page_faults ? vm->count.fault_prefetch_hits + vm->count.page_faults : 1));
+    }
+    // inverted page table: walk references, chain probes, probes per
+    // walk, and its frames next to those flat tables would take
+    if (vm->config.inverted) {
+        counter_t walks = vm->count.pt_walk_refs - vm->count.ipt_probes;
+        uint64_t flat = (vm->geo.num_pages * vm->geo.pte_bytes + vm->geo.page_size - 1) / vm->geo.page_size;
+        printf("inverted page table, %llu, %llu, %.2f, %u, %llu\n", vm->count.pt_walk_refs, vm->count.ipt_probes,
+               walks ? (double)vm->count.ipt_probes / walks : 0.0, vm->geo.pt_frames,
+               (counter_t)(flat * vm->config.max_procs));
+    }
+    // L1 hits by page size, promotions and splits
+    if (vm->geo.huge_order) {
+        printf("huge pages, %llu, %llu, %llu, %llu\n", vm->count.tlb_hits - vm->count.huge_tlb_hits, vm->count.huge_tlb_hits,
+               vm->count.huge_promotions, vm->count.huge_demotions);
+    }
+    // several processes: a line each, then the context switches
+    if (vm->num_procs > 1 && !vm->config.sample_period) {
+        for (uint32_t i = 0; i < vm->num_procs; i++) {
+            const proc_stats_t* p = &vm->proc_stats[i];
+            printf("pid %u, %llu, %llu, %llu, %llu, %llu, %llu\n", p->pid, p->accesses, p->tlb_hits,
+                   p->tlb_misses, p->page_faults, p->disk_writes, p->shutdown_writes);
+        }
+        printf("context switches, %llu\n", vm->count.context_switches);
+    }
+    // several cores: a line each, then the shootdowns and interrupts
+    if (vm->config.cores > 1 && !vm->config.sample_period) {
+        for (uint i = 0; i < vm->config.cores; i++) {
+            const core_stats_t* s = &vm->cores[i].stats;
+            printf("core %u, %llu, %llu, %llu, %llu, %llu, %llu\n", i, s->accesses, s->tlb_hits,
+                   s->tlb_misses, s->page_faults, s->shootdowns, s->ipis);
+        }
+        printf("shootdowns, %llu, %llu\n", vm->count.shootdowns, vm->count.shootdown_ipis);
+    }
+    // simulated cycles, AMAT and the share of each kind of cycle
+    // (and of shootdowns with several cores)
+    if (vm->config.timing) {
+        vm_timing_t t;
+        vm_estimate_timing(vm, &t);
+        double c = t.cycles ? (double)t.cycles : 1.0;
+        printf("timing, %llu, %.2f, %.4f, %.4f, %.4f, %.4f", t.cycles, t.amat,
+               t.translation / c, t.data / c, t.faults / c, t.writebacks / c);
+        if (vm->config.cores > 1) {
+            printf(", %.4f", t.shootdowns / c);
+        }
+        printf("\n");
+    }
+}
+
+// ---------------------------------------------------------
+//                      Checkpoints
+// ---------------------------------------------------------
+// header | huge_ranges | vm_state() | padding | mem[]
+// mem[] starts on a page boundary, so a restore maps the whole file
+// copy-on-write and uses its mem[] in place; everything else is
+// copied out into what system_init() allocated for the config.
+// ---------------------------------------------------------
+#define CKPT_MAGIC "VMCKPT06"
+#define CKPT_ALIGN 4096
+
+typedef struct ckpt_header_t {
+    char magic[8];
+    uint64_t position;      // trace records simulated
+    uint64_t mem_offset;
+    uint64_t length;        // of the whole file
+    vm_config_t config;     // huge_ranges -> NULL
+} ckpt_header_t;
+
+// the generator's state and where its two pointers are in it (the
+// rest of vm->rng is the same for every state of one seed's config)
+static void rng_checkpoint(vmsim_ctx* vm, ckpt_t* c)
+{
+    int64_t front = vm->rng.fptr - vm->rng_state;
+    int64_t rear = vm->rng.rptr - vm->rng_state;
+    ckpt_bytes(c, vm->rng_state, sizeof(vm->rng_state));
+    CKPT(c, front);
+    CKPT(c, rear);
+    if (front < 0 || front >= 32 || rear < 0 || rear >= 32) {
+        c->error = 1;
+        return;
+    }
+    vm->rng.fptr = vm->rng_state + front;
+    vm->rng.rptr = vm->rng_state + rear;
+}
+
+// everything but mem[] and the config
+static void vm_state(vmsim_ctx* vm, ckpt_t* c)
+{
+    // counters
+    CKPT(c, vm->count.accesses);
+    CKPT(c, vm->count.tlb_hits);
+    CKPT(c, vm->count.tlb_misses);
+    CKPT(c, vm->count.page_faults);
+    CKPT(c, vm->count.disk_writes);
+    CKPT(c, vm->count.shutdown_writes);
+    CKPT(c, vm->count.pt_walk_refs);
+    CKPT(c, vm->count.pt_table_frames);
+    CKPT(c, vm->count.ipt_probes);
+    CKPT(c, vm->count.context_switches);
+    CKPT(c, vm->count.l2_tlb_hits);
+    CKPT(c, vm->count.l2_tlb_misses);
+    CKPT(c, vm->count.pwc_hits);
+    CKPT(c, vm->count.pwc_misses);
+    CKPT(c, vm->count.huge_tlb_hits);
+    CKPT(c, vm->count.huge_promotions);
+    CKPT(c, vm->count.huge_demotions);
+    CKPT(c, vm->count.tlb_prefetch_walks);
+    CKPT(c, vm->count.tlb_prefetches);
+    CKPT(c, vm->count.tlb_prefetch_hits);
+    CKPT(c, vm->count.fault_prefetches);
+    CKPT(c, vm->count.fault_prefetch_hits);
+    CKPT(c, vm->count.wb_stall_cycles);
+    CKPT(c, vm->count.shootdowns);
+    CKPT(c, vm->count.shootdown_ipis);
+    CKPT(c, vm->count.ff_accesses);
+    CKPT(c, vm->count.ff_disk_writes);
+    // cores: TLBs, TLB prefetcher, process and stats
+    vm->cores[vm->cur_core].pid = vm->cur_pid;
+    vm->cores[vm->cur_core].asid = vm->cur_asid;
+    for (uint i = 0; i < vm->config.cores; i++) {
+        core_t* core = &vm->cores[i];
+        tlb_checkpoint(c, &core->TLB);
+        if (core->STLB.sets) {
+            tlb_checkpoint(c, &core->STLB);
+        }
+        if (core->PWC.sets) {
+            tlb_checkpoint(c, &core->PWC);
+        }
+        if (core->PB.sets) {
+            tlb_checkpoint(c, &core->PB);
+        }
+        prefetch_checkpoint(c, &core->pf);
+        CKPT(c, core->pid);
+        CKPT(c, core->asid);
+        CKPT(c, core->stats);
+    }
+    CKPT(c, vm->cur_core);
+    ckpt_bytes(c, vm->asid_cores, vm->config.max_procs * sizeof(uint64_t));
+    ckpt_bytes(c, vm->asid_ran, vm->config.max_procs * sizeof(uint64_t));
+    // frame indexes, of the frames handed out so far
+    CKPT(c, vm->frame_hwm);
+    CKPT(c, vm->num_evictable);
+    if (vm->frame_hwm > vm->geo.num_frames || vm->num_evictable > vm->frame_hwm) {
+        c->error = 1;
+        vm->frame_hwm = vm->num_evictable = 0;
+    }
+    ckpt_bytes(c, vm->free_frames, (vm->frame_hwm + 63) / 64 * sizeof(uint64_t));
+    CKPT(c, vm->free_hint);
+    ckpt_bytes(c, vm->evictable, vm->num_evictable * sizeof(ppn_t));
+    ckpt_bytes(c, vm->evictable_pos, vm->frame_hwm * sizeof(uint32_t));
+    // processes
+    ckpt_bytes(c, vm->proc_stats, vm->config.max_procs * sizeof(proc_stats_t));
+    CKPT(c, vm->num_procs);
+    CKPT(c, vm->slice_start);
+    CKPT(c, vm->asid_of_pid);
+    if (vm->cur_core >= vm->config.cores) {
+        c->error = 1;
+        vm->cur_core = 0;
+    }
+    core_load(vm, vm->cur_core);
+    // writeback queue
+    if (vm->wb_done) {
+        ckpt_bytes(c, vm->wb_done, vm->config.latency.queue * sizeof(counter_t));
+    }
+    CKPT(c, vm->wb_head);
+    CKPT(c, vm->wb_count);
+    CKPT(c, vm->wb_free);
+    // huge pages
+    if (vm->geo.huge_order) {
+        CKPT(c, vm->huge_hand);
+        huge_table_checkpoint(c, &vm->huge_regions);
+    }
+    // fault prefetcher, replacement policy and rand()
+    if (vm->prefetched) {
+        ckpt_bytes(c, vm->prefetched, vm->geo.num_frames);
+    }
+    policy_checkpoint(c, vm);
+    rng_checkpoint(vm, c);
+    sample_checkpoint(c, vm);
+}
+
+/*
+* Write the whole simulator state to path, position is how many
+* trace records it has simulated
+* returns 0 on success, -1 on an error
+*/
+int vm_checkpoint(vmsim_ctx* vm, const char* path, uint64_t position)
+{
+    FILE* out = fopen(path, "wb");
+    if (!out) {
+        return -1;
+    }
+    ckpt_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CKPT_MAGIC, sizeof(header.magic));
+    header.position = position;
+    header.config = vm->config;
+    header.config.huge_ranges = NULL;
+    ckpt_t c = { .out = out };
+    CKPT(&c, header);   // rewritten with the offsets at the end
+    ckpt_bytes(&c, (void*)vm->config.huge_ranges, vm->config.num_huge_ranges * sizeof(vm_range_t));
+    vm_state(vm, &c);
+    static byte_t zeros[CKPT_ALIGN];
+    ckpt_bytes(&c, zeros, (CKPT_ALIGN - c.pos % CKPT_ALIGN) % CKPT_ALIGN);
+    header.mem_offset = c.pos;
+    ckpt_sparse(&c, vm->mem, vm->config.mem_size, vm->geo.page_size);   // untouched frames are holes
+    header.length = c.pos;
+    if (!c.error && (fseek(out, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, out) != 1)) {
+        c.error = 1;
+    }
+    if (fclose(out) != 0) {
+        c.error = 1;
+    }
+    return c.error ? -1 : 0;
+}
+
+/*
+* Continue from a checkpoint in a new context
+* The simulation takes the checkpoint's config, apart from what only
+* changes the reports: the timing line is printed if either it or cfg
+* asks for it, intervals are cfg->interval and start over at the
+* checkpoint.
+* returns the context and the trace records to skip in *position, NULL
+* if path isn't a checkpoint (or out of memory)
+*/
+vmsim_ctx* vm_restore(const char* path, const vm_config_t* cfg, uint64_t* position)
 {
-    printf("%llu, %llu, %llu, %llu, %llu, %llu\n", accesses, tlb_hits, tlb_misses, page_faults, disk_writes, shutdown_writes);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(ckpt_header_t)) {
+        close(fd);
+        return NULL;
+    }
+    byte_t* map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);  // the mapping keeps the file alive
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    const ckpt_header_t* header = (const ckpt_header_t*)map;
+    size_t ranges = header->config.num_huge_ranges * sizeof(vm_range_t);
+    vmsim_ctx* vm = NULL;
+    if (memcmp(header->magic, CKPT_MAGIC, sizeof(header->magic)) != 0 ||
+        header->length != (uint64_t)st.st_size || header->mem_offset % CKPT_ALIGN ||
+        header->mem_offset + header->config.mem_size != header->length ||
+        sizeof(ckpt_header_t) + ranges > header->mem_offset ||
+        vm_config_check(&header->config) != 0 || !(vm = vm_alloc(&header->config,
+        ranges ? (const vm_range_t*)(map + sizeof(ckpt_header_t)) : NULL))) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    vm->config.timing |= cfg->timing;
+    vm->config.interval = cfg->interval;
+    if (vm_init(vm, map, st.st_size, header->mem_offset) != 0) {
+        if (vm->mem_map != map) {
+            munmap(map, st.st_size);
+        }
+        vmsim_destroy(vm);
+        return NULL;
+    }
+    ckpt_t c = { .in = map, .pos = sizeof(ckpt_header_t) + ranges, .length = header->mem_offset };
+    vm_state(vm, &c);
+    stats_reset(vm);
+    if (c.error || vm->error) {
+        vmsim_destroy(vm);
+        return NULL;
+    }
+    *position = header->position;
+    return vm;
 }
@@ -2,33 +2,300 @@
 #define __VMSIM_H
 
 #include <inttypes.h> /* For uintXX_t types */
+#include <stddef.h>
 
 typedef unsigned int uint;
 typedef unsigned long addr_t;
-typedef unsigned int uint32_t; //
 typedef unsigned long long counter_t;
-typedef unsigned long long uint64_t;
-typedef unsigned char uint8_t;
 typedef unsigned char byte_t;
-//new type for VPN -> 16 bits for 2^12 pages
+//new type for VPN -> 64 bits, the geometry is chosen at run time
 //---------------------------------------
-typedef uint16_t vpn_t;
-typedef uint16_t ppn_t;
+typedef uint64_t vpn_t;
+typedef uint32_t ppn_t;
 //---------------------------------------
 
+// default geometry, see vm_config_t
+#define MEM_SIZE (1 << 21)
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1 << PAGE_SHIFT)
+#define VA_BITS 24 // virtual addresses are 24 bits
+#define TLB_SIZE 5
+#define PT_MAX_LEVELS 4
+// processes: the TLB and the frame table tag pages with a 12 bit
+// ASID above a VPN of at most 49 bits
+#define ASID_BITS 12
+#define VPN_BITS 49
+#define VPN_MASK (((vpn_t)1 << VPN_BITS) - 1)
+#define VM_MAX_PROCS (1 << ASID_BITS)
+// cores, each with its own TLBs (a process's cores are a 64 bit mask)
+#define VM_MAX_CORES 64
+// TLB entries of huge pages are keyed ASID << VPN_BITS | HUGE_KEY |
+// VPN >> geo.huge_order, apart from base page entries
+#define HUGE_KEY ((vpn_t)1 << 61)
+
 typedef enum status_t {MISS, HIT} status_t;
 
-void system_init();
-byte_t* system_shutdown();
-status_t check_TLB(addr_t vaddr, uint write, addr_t* paddr);
-status_t check_PT(addr_t vaddr, uint write, addr_t* paddr);
-void update_TLB(addr_t vaddr, uint write, addr_t paddr, status_t tlb_access);
-uint32_t page_fault(addr_t vaddr, uint write);
-byte_t memory_access(addr_t vaddr, uint write, byte_t data) ;
-void vm_print_stats();
+// One trace record, fixed width so binary traces can be mmapped and
+// used in place (see trace.h). Text traces are
+// "op va pa size [pid [cpu]]".
+typedef struct record_t {
+    uint64_t va;
+    uint64_t pa;
+    uint32_t size;          // access size -> also the byte written
+    uint8_t op;             // 'r' or 'w'
+    uint8_t cpu;            // core, 0 if the trace has one
+    uint16_t pid;           // process, 0 if the trace has one
+} record_t;
 
-#define MEM_SIZE (1 << 21)
-#define PAGE_SIZE (1 << 12)
-#define TLB_SIZE 5
+// ---------------------------------------------------------
+//                      Structs in mem[]
+// ---------------------------------------------------------
+// Frame Table Entry
+typedef struct FT_entry { //8 BYTES
+    uint64_t mapped : 1;     // 1 if the frame is mapped, 0 if otherwise.
+    uint64_t protected : 1;  // 1 if the frame is protected, 0 if otherwise.
+    uint64_t referenced : 1; // set on every access, for CLOCK/aging
+    uint64_t asid : ASID_BITS;  // process of the page in the frame
+    uint64_t vpn : VPN_BITS;    // VPN of the page in the frame
+} FT_entry;
+
+// Page Table Entry, 2, 4 or 8 bytes -> the smallest that holds
+//   ppn << 2 | valid << 1 | dirty
+// for the number of frames (2 bytes for the default 512 frames)
+// Interior entries of a radix page table hold the next table's
+// frame the same way, with dirty unused.
+#define PTE_DIRTY 0x1
+#define PTE_VALID 0x2
+#define PTE_PPN_SHIFT 2
+
+// virtual address range [start, end)
+typedef struct vm_range_t {
+    addr_t start;
+    addr_t end;
+} vm_range_t;
+
+// Costs of the timing model in cycles, see vm_timing()
+typedef struct vm_latency_t {
+    uint l1;            // L1 TLB lookup, every access
+    uint l2;            // L2 TLB lookup, every L1 miss
+    uint pwc;           // page walk cache lookup, every radix walk
+    uint walk;          // page table memory reference
+    uint mem;           // data memory access
+    uint64_t fault;     // page fault, the disk read included
+    uint64_t disk;      // dirty page written back to disk
+    uint queue;         // writebacks in flight, 0 -> page faults wait for theirs
+    uint shootdown;     // TLB shootdown, on the core that remaps a page
+    uint ipi;           // each other core a shootdown interrupts
+} vm_latency_t;
+
+#define VM_LATENCY_DEFAULT { .l1 = 1, .l2 = 7, .pwc = 2, .walk = 100, .mem = 100, \
+    .fault = 1000000, .disk = 1000000, .queue = 0, .shootdown = 1000, .ipi = 3000 }
+
+// ---------------------------------------------------------
+// Run time configuration of a simulation, see vmsim_create()
+// ---------------------------------------------------------
+typedef struct vm_config_t {
+    uint tlb_sets;      // power of two, 1 -> fully associative
+    uint tlb_ways;
+    int tlb_simd;       // 0 -> scalar TLB search even if the CPU has SIMD
+    int rand_compat;    // 1 -> victim draws match the original rand() loop
+    int policy;         // page replacement policy, POLICY_*
+    uint seed;          // srand() seed, 1 like an unseeded rand()
+    uint64_t mem_size;  // physical memory bytes, a multiple of page_size
+    uint page_size;     // power of two
+    uint va_bits;       // virtual address width, addresses are masked to it
+    uint pt_levels;     // 1 -> flat page table, 2..PT_MAX_LEVELS -> radix tree
+    uint pt_fanout;     // entries per non-root table, 0 -> one page of PTEs
+    int inverted;       // 1 -> one hashed inverted page table for all processes
+                        // (flat only), an entry per frame instead of per page
+    uint max_procs;     // processes with a page table, up to VM_MAX_PROCS
+    int tlb_flush;      // 1 -> flush the TLB on context switches
+    uint cores;         // cores (trace cpus) with their own TLBs, up to VM_MAX_CORES
+    uint l2_sets;       // second level TLB, 0 -> none
+    uint l2_ways;
+    int l2_exclusive;   // 0 -> L2 holds everything in L1 (inclusive)
+    uint pwc_entries;   // page walk cache for radix tables, 0 -> none
+    uint64_t huge_size; // huge page bytes, 0 -> base pages only
+    uint huge_promote;  // resident base pages that promote a region to a huge
+                        // page, 0 -> all of them (none if there are huge_ranges)
+    const vm_range_t* huge_ranges;  // huge pages from the first touch in these
+    uint num_huge_ranges;
+    int tlb_prefetch;   // TLB prefetcher, PREFETCH_*
+    uint pb_entries;    // its prefetch buffer
+    uint fault_cluster; // page faults map the aligned cluster of this many
+                        // pages around the faulting one, 0 or 1 -> just it
+    vm_latency_t latency;
+    int timing;         // 1 -> vm_print_stats() reports the timing model
+    uint64_t interval;  // accesses per statistics interval, 0 -> one (stats.h)
+    uint64_t sample_period; // sampled simulation (sample.h): accesses per period,
+    uint64_t sample_window; // measured at its end after sample_warmup detailed
+    uint64_t sample_warmup; // ones, the rest fast-forwarded, 0 -> all detailed
+} vm_config_t;
+
+#define VM_CONFIG_DEFAULT { .tlb_sets = 1, .tlb_ways = TLB_SIZE, .tlb_simd = 1, \
+    .rand_compat = 0, .policy = 0, .seed = 1, .mem_size = MEM_SIZE, .page_size = PAGE_SIZE, \
+    .va_bits = VA_BITS, .pt_levels = 1, .pt_fanout = 0, .max_procs = 1, .tlb_flush = 0, .cores = 1, \
+    .l2_sets = 0, .l2_ways = 0, .l2_exclusive = 0, .pwc_entries = 0, \
+    .huge_size = 0, .huge_promote = 0, .huge_ranges = NULL, .num_huge_ranges = 0, \
+    .tlb_prefetch = 0, .pb_entries = 16, .fault_cluster = 0, \
+    .latency = VM_LATENCY_DEFAULT, .timing = 0, .interval = 0, \
+    .sample_period = 0, .sample_window = 0, .sample_warmup = 0 }
+
+// ---------------------------------------------------------
+// Memory geometry, derived from vm_config by vm_geometry()
+// ---------------------------------------------------------
+typedef struct vm_geometry_t {
+    uint page_shift;
+    uint64_t page_size;
+    addr_t offset_mask;
+    uint va_bits;
+    addr_t va_mask;
+    uint64_t num_pages;     // virtual pages = page table entries
+    uint32_t num_frames;
+    uint pte_bytes;         // 2, 4 or 8
+    uint pt_levels;
+    uint pt_bits;           // VPN bits per non-root level
+    uint root_bits;         // VPN bits of the root table (all of them if flat)
+    uint32_t ft_frames;     // frame table, from frame 0
+    uint32_t pt_frames;     // flat page table or radix root of each process,
+                            // one after the other after the frame table
+                            // (the one inverted page table if config.inverted)
+    uint hat_bits;          // inverted page table: 1 << hat_bits hash buckets
+    uint huge_order;        // base pages per huge page = 1 << huge_order, 0 -> none
+    uint32_t huge_promote;  // resident base pages that promote a region, 0 -> never
+} vm_geometry_t;
+
+int vm_config_tlb(vm_config_t* cfg, uint entries, uint ways);
+int vm_config_l2_tlb(vm_config_t* cfg, uint entries, uint ways);
+int vm_config_check(const vm_config_t* cfg);
+int vm_geometry(const vm_config_t* cfg, vm_geometry_t* g);
+uint64_t vm_parse_size(const char* s);
+int vm_parse_ranges(const char* s, vm_range_t** ranges);
+int vm_parse_latency(const char* s, vm_latency_t* lat);
+int vm_parse_sampling(const char* s, vm_config_t* cfg);
+
+// ---------------------------------------------------------
+// Processes, numbered by ASID in order of their first access
+// Stats are charged to the process running when they happen.
+// ---------------------------------------------------------
+typedef struct proc_stats_t {
+    uint pid;
+    counter_t accesses, tlb_hits, tlb_misses, page_faults, disk_writes, shutdown_writes;
+} proc_stats_t;
+
+// ---------------------------------------------------------
+// Cores: stats are charged to the core of the access. Every remap
+// of a page (an eviction, a huge page promotion or split) is a TLB
+// shootdown by the core that faulted, which interrupts the other
+// cores that ran the page's process. With one core a remap just
+// invalidates its own TLBs and isn't counted.
+// ---------------------------------------------------------
+typedef struct core_stats_t {
+    counter_t accesses, tlb_hits, tlb_misses, page_faults;
+    counter_t shootdowns;   // started by this core
+    counter_t ipis;         // received from the other cores
+} core_stats_t;
+
+// ---------------------------------------------------------
+// Event counts of a simulation
+// ---------------------------------------------------------
+typedef struct vm_counters_t {
+    counter_t accesses, tlb_hits, tlb_misses, page_faults, disk_writes, shutdown_writes;
+    // page table reads on TLB misses, frames taken by radix tables, and of
+    // the reads chain entries of an inverted page table
+    counter_t pt_walk_refs, pt_table_frames, ipt_probes;
+    counter_t context_switches;
+    // second level TLB and page walk cache lookups (on L1 misses / walks)
+    counter_t l2_tlb_hits, l2_tlb_misses, pwc_hits, pwc_misses;
+    // L1 hits on huge page entries (tlb_hits has them too), regions mapped
+    // as huge pages and huge pages split back into base pages
+    counter_t huge_tlb_hits, huge_promotions, huge_demotions;
+    // TLB prefetcher walks, translations it put in the prefetch buffer and
+    // L1 misses the buffer had; pages mapped around page faults and those
+    // accessed before they were evicted
+    counter_t tlb_prefetch_walks, tlb_prefetches, tlb_prefetch_hits;
+    counter_t fault_prefetches, fault_prefetch_hits;
+    // cycles spent waiting for dirty page writebacks
+    counter_t wb_stall_cycles;
+    // TLB shootdowns and the interrupts they sent (more than one core)
+    counter_t shootdowns, shootdown_ipis;
+    // accesses fast-forwarded by sampling, in no other counter, and the
+    // dirty pages evicted meanwhile (not in disk_writes)
+    counter_t ff_accesses, ff_disk_writes;
+} vm_counters_t;
+
+// ---------------------------------------------------------
+// A simulation: memory, TLBs, page tables and counters of one
+// config. All simulator state lives in its context, so independent
+// contexts may run on different threads; one context is driven by
+// one thread at a time. An error inside a simulation (out of memory,
+// more processes or cores in the trace than the config has, page
+// tables filling physical memory) stops it: the call that hit it
+// returns -1 and so does every later one, vmsim_error() says why.
+// The context can still be read and destroyed.
+// ---------------------------------------------------------
+typedef struct vmsim_ctx vmsim_ctx;
+
+// fills recs with up to max records, returns how many, 0 at the end
+typedef size_t (*vmsim_source_t)(void* arg, record_t* recs, size_t max);
+
+vmsim_ctx* vmsim_create(const vm_config_t* cfg);
+void vmsim_destroy(vmsim_ctx* vm);
+int vmsim_run(vmsim_ctx* vm, vmsim_source_t source, void* arg);
+const char* vmsim_error(const vmsim_ctx* vm, uint64_t* record);
+const vm_config_t* vmsim_config(const vmsim_ctx* vm);
+const vm_geometry_t* vmsim_geometry(const vmsim_ctx* vm);
+const vm_counters_t* vmsim_counters(const vmsim_ctx* vm);
+const core_stats_t* vmsim_core_stats(const vmsim_ctx* vm, uint core);
+
+int vm_core(vmsim_ctx* vm, uint cpu);
+int vm_switch(vmsim_ctx* vm, uint pid);
+
+int system_init(vmsim_ctx* vm);
+byte_t* system_shutdown(vmsim_ctx* vm);
+status_t check_TLB(vmsim_ctx* vm, addr_t vaddr, uint write, addr_t* paddr);
+status_t check_PT(vmsim_ctx* vm, addr_t vaddr, uint write, addr_t* paddr);
+void update_TLB(vmsim_ctx* vm, addr_t vaddr, uint write, addr_t paddr, status_t tlb_access);
+uint32_t page_fault(vmsim_ctx* vm, addr_t vaddr, uint write);
+byte_t memory_access(vmsim_ctx* vm, addr_t vaddr, uint write, byte_t data) ;
+int memory_access_batch(vmsim_ctx* vm, const record_t* recs, size_t n, byte_t* out);
+void vm_print_stats(vmsim_ctx* vm);
+uint32_t vm_free_frames(vmsim_ctx* vm);
+int vm_checkpoint(vmsim_ctx* vm, const char* path, uint64_t position);
+vmsim_ctx* vm_restore(const char* path, const vm_config_t* cfg, uint64_t* position);
+
+// ---------------------------------------------------------
+// Timing model: simulated cycles of the run so far, from the event
+// counts and vm_config.latency, split by where they went
+// ---------------------------------------------------------
+typedef struct vm_timing_t {
+    counter_t cycles;       // all of the below
+    counter_t translation;  // TLB lookups and page walks
+    counter_t data;         // data memory accesses
+    counter_t faults;       // page faults
+    counter_t writebacks;   // waiting on dirty page writebacks
+    counter_t shootdowns;   // TLB shootdowns and their interrupts
+    double amat;            // cycles per access
+} vm_timing_t;
+
+void vm_timing(const vmsim_ctx* vm, vm_timing_t* t);
+
+// ---------------------------------------------------------
+// Estimates of a sampled simulation: rates per access of TLB misses,
+// page faults and disk writes, the mean over the measured windows and
+// the half width of its 95% confidence interval. Without sampling
+// the counters' exact rates, intervals 0. vm_estimate_timing() is
+// vm_timing() extrapolated the same way.
+// ---------------------------------------------------------
+typedef struct vm_estimate_t {
+    counter_t accesses;     // all of them, fast-forwarded ones too
+    counter_t windows;      // measured
+    double tlb_miss_rate, tlb_miss_ci;
+    double fault_rate, fault_ci;
+    double disk_write_rate, disk_write_ci;
+} vm_estimate_t;
+
+void vm_estimate(const vmsim_ctx* vm, vm_estimate_t* e);
+void vm_estimate_timing(const vmsim_ctx* vm, vm_timing_t* t);
 
 #endif